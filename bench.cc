@@ -0,0 +1,534 @@
+/*------------------------------------------------------------------------
+ *  Copyright (C) 2000-2008, Universidad de Zaragoza, SPAIN
+ *
+ *  Contact Addresses: Danilo Tardioli                   dantard@unizar.es
+ *
+ *  eBottle is free software;  you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation;  either version 2, or (at your option) any
+ *  later version.
+ *
+ *  eBottle is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  distributed with eBottle; see file COPYING. If not,  write to the
+ *  Free Software  Foundation, 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ *  As a special exception, if you link this unit with other files to
+ *  produce an executable, this unit does not by itself cause the resulting
+ *  executable to be covered by the GNU General Public License.  This
+ *  exception does not however invalidate any other reasons why the
+ *  executable file might be covered by the GNU Public License.
+ *
+ *-------------------------------------------------------------------------*/
+
+/*
+ * Microbenchmarks for eBottle, and for yarp::os::Bottle to compare with.
+ * 
+ * Usage: eBottleBench [seconds per case] [filter]
+ * 
+ * Every operation is timed on every message shape, repeating it until 
+ * the time budget of the case (0.2 s by default) is spent. Only the cases 
+ * whose "impl/shape/op" name contains the filter are run. A table is 
+ * printed to stderr and the results go to stdout as CSV with the columns
+ * 
+ *     impl,shape,op,ns_per_op,bytes_per_s,allocs_per_op
+ * 
+ * so runs of different releases can be compared with diff or a 
+ * spreadsheet. Build without BENCH_NO_BOTTLE to include Bottle.
+ * 
+ * The "-lz" operations use payload compression; for them the table also 
+ * gives the link speed below which compressing saves time end to end.
+ * "loopback-delta" sends a message that does not change through an 
+ * eBottleDeltaWriter, so it times the delta path of a static stream.
+ * "shm" is a round trip to a second process through shared memory: the 
+ * message is viewed in place there and an empty eBottle comes back.
+ * "ring" and "ring-mpsc" hand the message to another thread through an 
+ * eBottleRing or eBottleMultiRing, copying it into the slot, as the 
+ * in-process alternative to "loopback".
+ * 
+ * The "arm-state" shape is a message with a fixed layout, timed as an 
+ * eBottleSchema, as the same values in an eBottle and, for reference, 
+ * as a struct copied with memcpy. Its "build" and "read" operations 
+ * fill and read the eBottle with addInt/getPtr, and "build-typed" and 
+ * "read-typed" with addAll/get_unchecked.
+ * 
+ * The "map-200000" shape is a point map of (x y z intensity) lists, 
+ * written and read with parallel coding on 1, 2, 4... threads up to one 
+ * per processor: "toBinary-t4" and "fromBinary-t4" are the times with 4.
+ */
+
+#include <yarp/os/eBottle.h>
+#include <yarp/os/eShm.h>
+#include <yarp/os/eRing.h>
+#include <yarp/os/eSchema.h>
+#include <yarp/os/all.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace yarp::os;
+
+/*
+ * Every allocation of the process goes through here to be counted, also 
+ * the ones of the worker threads of parallel coding
+ */
+static std::atomic<unsigned long> allocations(0);
+
+void * operator new(size_t n) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void * p=malloc(n>0 ? n : 1);
+	if (p==NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void * operator new[](size_t n) {
+	return operator new(n);
+}
+
+void operator delete(void * p) noexcept {
+	free(p);
+}
+
+void operator delete[](void * p) noexcept {
+	free(p);
+}
+
+void operator delete(void * p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void * p, size_t) noexcept {
+	free(p);
+}
+
+struct Shape {
+	const char * name;
+	// 0 ints, 1 doubles, 2 nested lists, 3 blobs, 4 strings, 5 double array,
+	// 6 depth maps
+	int kind;
+	int n;
+};
+
+static const Shape SHAPES[]={
+	{ "ints-10", 0, 10 },
+	{ "ints-100", 0, 100 },
+	{ "ints-1000", 0, 1000 },
+	{ "ints-10000", 0, 10000 },
+	{ "doubles-1000", 1, 1000 },
+	{ "nested-64", 2, 64 },
+	{ "blobs-8x256k", 3, 8 },
+	{ "strings-2000", 4, 2000 },
+	{ "double-array-10000", 5, 10000 },
+	{ "depth-8x640x480", 6, 8 },
+};
+
+static const unsigned int BLOB_SIZE=256*1024;
+
+// 16 bit depths of a tilted plane with a box on it and some sensor noise
+static std::vector<char> depthMap() {
+	const int w=640, h=480;
+	std::vector<char> d(w*h*2);
+	unsigned int seed=1;
+	for (int y=0; y<h; y++) {
+		for (int x=0; x<w; x++) {
+			seed=seed*1103515245+12345;
+			uint16_t v=2000+y*4+(((seed>>16)%8==0) ? (seed>>20)%3 : 0);
+			if (x>200 && x<400 && y>150 && y<350) {
+				v=1200;
+			}
+			memcpy(&d[2*(y*w+x)], &v, 2);
+		}
+	}
+	return d;
+}
+
+static void addBlob(eBottle & b, const char * p, int n) {
+	b.addBlob(p, n);
+}
+
+static bool addArray(eBottle & b, const double * p, int n) {
+	b.addDoubleArray(p, n);
+	return true;
+}
+
+#ifndef BENCH_NO_BOTTLE
+static void addBlob(Bottle & b, const char * p, int n) {
+	b.add(Value::makeBlob((void *) p, n));
+}
+
+static bool addArray(Bottle &, const double *, int) {
+	return false;
+}
+#endif
+
+// fills b with the shape, false if the implementation has no such values
+template <class B> static bool build(B & b, const Shape & s) {
+	static std::vector<char> blob(BLOB_SIZE, 'b');
+	static std::vector<double> doubles(10000, 0.5);
+	static std::vector<char> depth=depthMap();
+	switch (s.kind) {
+		case 0:
+			for (int i=0; i<s.n; i++) {
+				b.addInt(i);
+			}
+			break;
+		case 1:
+			for (int i=0; i<s.n; i++) {
+				b.addDouble(i*0.5);
+			}
+			break;
+		case 2: {
+			B * l=&b;
+			for (int i=0; i<s.n; i++) {
+				for (int j=0; j<4; j++) {
+					l->addInt(j);
+				}
+				l=&l->addList();
+			}
+			break;
+		}
+		case 3:
+			for (int i=0; i<s.n; i++) {
+				addBlob(b, &blob[0], blob.size());
+			}
+			break;
+		case 4:
+			for (int i=0; i<s.n; i++) {
+				char text[32];
+				sprintf(text, "string-number-%08d", i);
+				b.addString(text);
+			}
+			break;
+		case 5:
+			return addArray(b, &doubles[0], s.n);
+		case 6:
+			for (int i=0; i<s.n; i++) {
+				addBlob(b, &depth[0], depth.size());
+			}
+			break;
+	}
+	return true;
+}
+
+struct Result {
+	std::string impl;
+	std::string shape;
+	std::string op;
+	double ns;
+	double bytesPerSecond;
+	double allocs;
+};
+
+static std::vector<Result> results;
+static double budget=0.2;
+static const char * filter="";
+
+// times f, doubling the repetitions until the budget is spent
+template <class F> static void measure(const char * impl, const char * shape, const char * op, const double bytes, F f) {
+	std::string name=std::string(impl)+"/"+shape+"/"+op;
+	if (strstr(name.c_str(), filter)==NULL) {
+		return;
+	}
+	f();
+	unsigned long reps=1;
+	while (true) {
+		unsigned long a=allocations.load(std::memory_order_relaxed);
+		std::chrono::steady_clock::time_point t0=std::chrono::steady_clock::now();
+		for (unsigned long i=0; i<reps; i++) {
+			f();
+		}
+		double t=std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+		if (t>=budget || reps>=(1ul<<30)) {
+			Result r;
+			r.impl=impl;
+			r.shape=shape;
+			r.op=op;
+			r.ns=t*1e9/reps;
+			r.bytesPerSecond=bytes*reps/t;
+			r.allocs=(double) (allocations.load(std::memory_order_relaxed)-a)/reps;
+			results.push_back(r);
+			fprintf(stderr, "%-8s %-20s %-12s %14.1f ns/op %10.1f MB/s %10.1f allocs/op\n",
+					impl, shape, op, r.ns, r.bytesPerSecond/1e6, r.allocs);
+			return;
+		}
+		reps*=2;
+	}
+}
+
+// time of a case already measured, 0 if it was filtered out
+static double timeOf(const char * impl, const char * shape, const char * op) {
+	for (unsigned int i=0; i<results.size(); i++) {
+		if (results[i].impl==impl && results[i].shape==shape && results[i].op==op) {
+			return results[i].ns;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Sends a message through the same path as a port, without the network
+ */
+static bool loopback(PortWriter & src, PortReader & dst) {
+	return Portable::copyPortable(src, dst);
+}
+
+static void benchShm(const eBottle & src, const char * shape, const double bytes) {
+	std::string name=std::string("eBottle/")+shape+"/shm";
+	if (strstr(name.c_str(), filter)==NULL) {
+		return;
+	}
+	// both ends of both rings are opened here, and the mappings are 
+	// inherited by the child
+	eShmWriter request, reply;
+	eShmReader in, ack;
+	if (!request.open("/eBottleBench/request", 2, src.getBinarySize()) || !reply.open("/eBottleBench/reply", 1, 64)
+			|| !in.open("/eBottleBench/request") || !ack.open("/eBottleBench/reply")) {
+		return;
+	}
+	eBottleView v;
+	pid_t child=fork();
+	if (child==0) {
+		eBottle empty;
+		while (in.read(v, 10) && v.size()>0) {
+			reply.write(empty, 10);
+		}
+		_exit(0);
+	}
+	measure("eBottle", shape, "shm", bytes, [&]() { request.write(src, 10); ack.read(v, 10); });
+	request.write(eBottle(), 10);
+	waitpid(child, NULL, 0);
+}
+
+static void publish(eBottleRing & ring, eBottle *) {
+	ring.write();
+}
+
+static void publish(eBottleMultiRing & ring, eBottle * b) {
+	ring.write(b);
+}
+
+template <class R> static void benchRing(const eBottle & src, const char * shape, const char * op, const double bytes) {
+	R ring(16);
+	// an empty message stops the consumer
+	std::thread consumer([&]() {
+		bool last=false;
+		while (!last) {
+			last=ring.read()->count()==0;
+			ring.done();
+		}
+	});
+	measure("eBottle", shape, op, bytes, [&]() { eBottle * b=ring.prepare(); *b=src; publish(ring, b); });
+	eBottle * b=ring.prepare();
+	b->clear();
+	publish(ring, b);
+	consumer.join();
+}
+
+static void benchEBottle(const Shape & s) {
+	eBottle src;
+	if (!build(src, s)) {
+		return;
+	}
+	eBottle dst;
+	int size;
+	const char * bin=src.toBinary(&size);
+	std::vector<char> binary(bin, bin+size);
+	std::string text=src.toString();
+	double bytes=size;
+
+	measure("eBottle", s.name, "assign", bytes, [&]() { dst=src; });
+	measure("eBottle", s.name, "copy", bytes, [&]() { dst.copy(&src); });
+	measure("eBottle", s.name, "toBinary", bytes, [&]() { int n; src.toBinary(&n); });
+	measure("eBottle", s.name, "fromBinary", bytes, [&]() { dst.clear(); dst.fromBinary(&binary[0], size); });
+	measure("eBottle", s.name, "toString", text.size(), [&]() { src.toString(); });
+	measure("eBottle", s.name, "fromString", text.size(), [&]() { dst.clear(); dst.fromString(text); });
+	measure("eBottle", s.name, "loopback", bytes, [&]() { loopback(src, dst); });
+
+	// a stream whose values do not change, sent as deltas after a keyframe
+	eBottle streamed;
+	eBottleDeltaWriter deltaWriter(src, 0);
+	eBottleDeltaReader deltaReader(streamed);
+	loopback(deltaWriter, deltaReader);
+	measure("eBottle", s.name, "loopback-delta", bytes, [&]() { loopback(deltaWriter, deltaReader); });
+	benchShm(src, s.name, bytes);
+	benchRing<eBottleRing>(src, s.name, "ring", bytes);
+	benchRing<eBottleMultiRing>(src, s.name, "ring-mpsc", bytes);
+
+	if (s.kind!=3 && s.kind!=6) {
+		return;
+	}
+	eBottle packed(src);
+	packed.setCompression();
+	int packedSize;
+	bin=packed.toBinary(&packedSize);
+	std::vector<char> packedBinary(bin, bin+packedSize);
+	measure("eBottle", s.name, "toBinary-lz", bytes, [&]() { int n; packed.toBinary(&n); });
+	measure("eBottle", s.name, "fromBinary-lz", bytes, [&]() { dst.clear(); dst.fromBinary(&packedBinary[0], packedSize); });
+	// compressing pays off while the time it adds is less than the time 
+	// the saved bytes take on the link
+	double extra=timeOf("eBottle", s.name, "toBinary-lz")+timeOf("eBottle", s.name, "fromBinary-lz")
+			-timeOf("eBottle", s.name, "toBinary")-timeOf("eBottle", s.name, "fromBinary");
+	if (extra>0) {
+		fprintf(stderr, "%-8s %-20s ratio %.3f, pays off on links below %.1f MB/s\n",
+				"eBottle", s.name, (double) packedSize/size, (size-packedSize)/extra*1e3);
+	}
+}
+
+// a joint state: sequence, positions and a named pose
+typedef eBottleSchema<int, eDoubleArray<7>, eList<std::string, double, double, double> > ArmState;
+
+struct ArmStruct {
+	int sequence;
+	double positions[7];
+	char name[16];
+	double pose[3];
+};
+
+static void benchSchema() {
+	ArmState src, dst;
+	src.get<0>()=1;
+	for (unsigned int i=0; i<7; i++) {
+		src.get<1>()[i]=0.1*i;
+	}
+	src.get<2>()=std::make_tuple(std::string("home"), 0.5, -0.25, 1.0);
+	std::vector<char> binary(src.getBinarySize());
+	const int size=src.toBinary(&binary[0]);
+	eBottle bottle, bottleDst;
+	src.toBottle(bottle);
+	int bottleSize;
+	const char * bin=bottle.toBinary(&bottleSize);
+	std::vector<char> bottleBinary(bin, bin+bottleSize);
+	ArmStruct a, b;
+	memset(&a, 0, sizeof(a));
+	char raw[sizeof(ArmStruct)];
+
+	measure("eSchema", "arm-state", "toBinary", size, [&]() { src.toBinary(&binary[0]); });
+	measure("eSchema", "arm-state", "fromBinary", size, [&]() { dst.fromBinary(&binary[0], size); });
+	measure("eSchema", "arm-state", "loopback", size, [&]() { loopback(src, dst); });
+	measure("eBottle", "arm-state", "toBinary", bottleSize, [&]() { int n; bottle.toBinary(&n); });
+	measure("eBottle", "arm-state", "fromBinary", bottleSize, [&]() { bottleDst.clear(); bottleDst.fromBinary(&bottleBinary[0], bottleSize); });
+	measure("eBottle", "arm-state", "loopback", bottleSize, [&]() { loopback(bottle, bottleDst); });
+	const std::vector<double> positions(src.get<1>().begin(), src.get<1>().end());
+	eBottle built;
+	double sum=0;
+	measure("eBottle", "arm-state", "build", bottleSize, [&]() {
+		built.clear();
+		built.addInt(1);
+		built.addDoubleArray(&positions[0], positions.size());
+		eBottle & pose=built.addList();
+		pose.addString("home");
+		pose.addDouble(0.5);
+		pose.addDouble(-0.25);
+		pose.addDouble(1.0);
+	});
+	measure("eBottle", "arm-state", "build-typed", bottleSize, [&]() {
+		built.clear();
+		built.addAll(1, positions);
+		built.addList().addAll("home", 0.5, -0.25, 1.0);
+	});
+	measure("eBottle", "arm-state", "read", bottleSize, [&]() {
+		const eBottle * pose=built.getPtr(2)->asList();
+		sum+=built.getPtr(0)->asInt()+pose->getPtr(1)->asDouble()+pose->getPtr(2)->asDouble()+pose->getPtr(3)->asDouble();
+	});
+	measure("eBottle", "arm-state", "read-typed", bottleSize, [&]() {
+		const eBottle * pose=built.get_unchecked<const eBottle *>(2);
+		sum+=built.get_unchecked<int>(0)+pose->get_unchecked<double>(1)+pose->get_unchecked<double>(2)+pose->get_unchecked<double>(3);
+	});
+	// keeps the reads from being optimized away
+	if (sum==0) {
+		fprintf(stderr, "%g\n", sum);
+	}
+	measure("struct", "arm-state", "memcpy", sizeof(a), [&]() {
+		memcpy(raw, &a, sizeof(a));
+		// keeps the compiler from folding the copies
+		__asm__ __volatile__("" : : "r"(raw) : "memory");
+		memcpy(&b, raw, sizeof(b));
+		a.sequence=b.sequence+1;
+	});
+}
+
+static void benchParallel() {
+	const char * shape="map-200000";
+	eBottle src;
+	src.setParallel(1);
+	for (int i=0; i<200000; i++) {
+		src.addList().addAll(0.01*i, 0.02*(i%640), 1.5, i%256);
+	}
+	int size;
+	const char * bin=src.toBinary(&size);
+	std::vector<char> binary(bin, bin+size);
+	eBottle dst;
+	dst.setParallel(1);
+	const unsigned int most=std::thread::hardware_concurrency();
+	for (unsigned int t=1; t<=most; t=(t<most && 2*t>most) ? most : 2*t) {
+		eBottle::setThreads(t);
+		char op[32];
+		snprintf(op, sizeof(op), "toBinary-t%u", t);
+		measure("eBottle", shape, op, size, [&]() { int n; src.toBinary(&n); });
+		snprintf(op, sizeof(op), "fromBinary-t%u", t);
+		measure("eBottle", shape, op, size, [&]() { dst.clear(); dst.fromBinary(&binary[0], size); });
+	}
+	eBottle::setThreads(0);
+}
+
+#ifndef BENCH_NO_BOTTLE
+static void benchBottle(const Shape & s) {
+	Bottle src;
+	if (!build(src, s)) {
+		return;
+	}
+	Bottle dst;
+	size_t size;
+	const char * bin=src.toBinary(&size);
+	std::vector<char> binary(bin, bin+size);
+	std::string text=src.toString().c_str();
+	double bytes=size;
+
+	measure("Bottle", s.name, "assign", bytes, [&]() { dst=src; });
+	measure("Bottle", s.name, "copy", bytes, [&]() { dst.copy(src); });
+	measure("Bottle", s.name, "toBinary", bytes, [&]() { size_t n; src.toBinary(&n); });
+	measure("Bottle", s.name, "fromBinary", bytes, [&]() { dst.fromBinary(&binary[0], size); });
+	measure("Bottle", s.name, "toString", text.size(), [&]() { src.toString(); });
+	measure("Bottle", s.name, "fromString", text.size(), [&]() { dst.fromString(text.c_str()); });
+	measure("Bottle", s.name, "loopback", bytes, [&]() { loopback(src, dst); });
+}
+#endif
+
+int main(int argc, char ** argv) {
+	if (argc>1) {
+		budget=atof(argv[1]);
+	}
+	if (argc>2) {
+		filter=argv[2];
+	}
+	benchSchema();
+	benchParallel();
+	for (unsigned int i=0; i<sizeof(SHAPES)/sizeof(SHAPES[0]); i++) {
+		benchEBottle(SHAPES[i]);
+#ifndef BENCH_NO_BOTTLE
+		benchBottle(SHAPES[i]);
+#endif
+	}
+	printf("impl,shape,op,ns_per_op,bytes_per_s,allocs_per_op\n");
+	for (unsigned int i=0; i<results.size(); i++) {
+		const Result & r=results[i];
+		printf("%s,%s,%s,%.1f,%.0f,%.2f\n", r.impl.c_str(), r.shape.c_str(), r.op.c_str(), r.ns, r.bytesPerSecond, r.allocs);
+	}
+	return 0;
+}
@@ -27,95 +27,695 @@
  *-------------------------------------------------------------------------*/
 
 #include <yarp/os/eBottle.h>
+#include <yarp/os/eKernels.h>
+#include <yarp/os/eCompress.h>
+#include <yarp/os/eWire.h>
 #include <yarp/os/all.h>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
 #include <string>
-#include <sstream>
 #include <vector>
+#include <stdint.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define EPOOL_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define EPOOL_ASAN
+#endif
+#endif
+
+#ifdef EPOOL_ASAN
+#include <sanitizer/asan_interface.h>
+#else
+#define ASAN_POISON_MEMORY_REGION(p, n) ((void) (p), (void) (n))
+#define ASAN_UNPOISON_MEMORY_REGION(p, n) ((void) (p), (void) (n))
+#endif
 
 using yarp::os::eValue;
 using yarp::os::eBottle;
 using yarp::os::ConstString;
 
-eValue::eValue() {
+using yarp::os::eArena;
+using yarp::os::ePool;
+using yarp::os::eValueView;
+using yarp::os::eBottleView;
+using yarp::os::eBottleDecoder;
+using yarp::os::eBottleDeltaWriter;
+using yarp::os::eBottleDeltaReader;
+namespace eKernels = yarp::os::eKernels;
+
+eArena::eArena(const size_t chunk) {
+	Chunk c;
+	c.size=chunk;
+	c.base=new char[c.size];
+	chunks.push_back(c);
+	current=0;
+	offset=0;
+	total=0;
+	live=0;
+}
+
+eArena::~eArena() {
+	for (unsigned int i=0; i<chunks.size(); i++) {
+		delete [] chunks[i].base;
+	}
+}
+
+void eArena::grow(const size_t n) {
+	total+=chunks[current].size-offset;
+	offset=0;
+	while (++current<chunks.size()) {
+		if (chunks[current].size>=n) {
+			return;
+		}
+		total+=chunks[current].size;
+	}
+	Chunk c;
+	c.size=2*chunks.back().size;
+	if (c.size<n) {
+		c.size=n;
+	}
+	c.base=new char[c.size];
+	chunks.push_back(c);
+	current=chunks.size()-1;
+}
+
+void * eArena::allocate(const size_t n, const size_t align) {
+	size_t pad=(align-offset%align)%align;
+	if (offset+pad+n>chunks[current].size) {
+		grow(n);
+		pad=0;
+	}
+	void * p=chunks[current].base+offset+pad;
+	offset+=pad+n;
+	total+=pad+n;
+	return p;
+}
+
+void eArena::reserve(const size_t n) {
+	if (offset+n>chunks[current].size) {
+		grow(n);
+	}
+}
+
+void eArena::reset() {
+	if (chunks.size()>1) {
+		// keep one chunk big enough for everything used so far
+		size_t size=0;
+		for (unsigned int i=0; i<chunks.size(); i++) {
+			size+=chunks[i].size;
+			delete [] chunks[i].base;
+		}
+		chunks.resize(1);
+		chunks[0].size=size;
+		chunks[0].base=new char[size];
+	}
+	current=0;
+	offset=0;
+	total=0;
+	live=0;
+}
+
+size_t eArena::used() const {
+	return total;
+}
+
+/*
+ * The free lists of each thread, one per size class from MIN_BLOCK to 
+ * ePool::MAX_BLOCK. They are plain thread_local data, so they can be used 
+ * until the thread ends; a Reaper gives their blocks back to the heap 
+ * then. In AddressSanitizer builds the blocks are poisoned while they are 
+ * in a list, so that using one after it was freed is still reported.
+ */
+static const size_t MIN_BLOCK=16;
+static const unsigned int CLASSES=9;
+
+struct FreeBlock {
+	FreeBlock * next;
+};
+
+static thread_local FreeBlock * freeLists[CLASSES];
+static thread_local ePool::Stats poolStats;
+static thread_local bool poolExited;
+static std::atomic<size_t> poolLimit(1<<20);
+
+struct Reaper {
+	~Reaper() {
+		ePool::trim();
+		poolExited=true;
+	}
+};
+
+static thread_local Reaper reaper;
+
+static inline unsigned int sizeClass(const size_t n) {
+	unsigned int c=0;
+	for (size_t s=MIN_BLOCK; s<n; s<<=1) {
+		c++;
+	}
+	return c;
+}
+
+void * ePool::allocate(const size_t n) {
+	if (n>MAX_BLOCK) {
+		return ::operator new(n);
+	}
+	const unsigned int c=sizeClass(n);
+	FreeBlock * b=freeLists[c];
+	if (b!=NULL) {
+		ASAN_UNPOISON_MEMORY_REGION(b, MIN_BLOCK<<c);
+		freeLists[c]=b->next;
+		poolStats.hits++;
+		poolStats.retained-=MIN_BLOCK<<c;
+		return b;
+	}
+	poolStats.misses++;
+	return ::operator new(MIN_BLOCK<<c);
+}
+
+void ePool::deallocate(void * p, const size_t n) {
+	if (p==NULL) {
+		return;
+	}
+	if (n>MAX_BLOCK) {
+		::operator delete(p);
+		return;
+	}
+	const unsigned int c=sizeClass(n);
+	if (poolExited || poolStats.retained+(MIN_BLOCK<<c)>poolLimit.load(std::memory_order_relaxed)) {
+		::operator delete(p);
+		return;
+	}
+	// makes sure the thread gives the blocks back when it ends
+	(void) &reaper;
+	FreeBlock * b=(FreeBlock *) p;
+	b->next=freeLists[c];
+	freeLists[c]=b;
+	poolStats.retained+=MIN_BLOCK<<c;
+	ASAN_POISON_MEMORY_REGION(b, MIN_BLOCK<<c);
+}
+
+ePool::Stats ePool::stats() {
+	return poolStats;
+}
+
+void ePool::resetStats() {
+	poolStats.hits=0;
+	poolStats.misses=0;
+}
+
+void ePool::trim() {
+	for (unsigned int c=0; c<CLASSES; c++) {
+		while (freeLists[c]!=NULL) {
+			FreeBlock * b=freeLists[c];
+			ASAN_UNPOISON_MEMORY_REGION(b, MIN_BLOCK<<c);
+			freeLists[c]=b->next;
+			::operator delete(b);
+		}
+	}
+	poolStats.retained=0;
+}
+
+void ePool::setLimit(const size_t bytes) {
+	poolLimit.store(bytes, std::memory_order_relaxed);
+}
+
+size_t ePool::getLimit() {
+	return poolLimit.load(std::memory_order_relaxed);
+}
+
+/*
+ * Long strings are kept in a block that can be shared by several eValues.
+ */
+struct eValue::SharedString {
+	SharedString(const std::string& t) : refs(1), s(t) {}
+	SharedString(const char * t) : refs(1), s(t) {}
+	SharedString(std::string && t) : refs(1), s(std::move(t)) {}
+	std::atomic<int> refs;
+	std::string s;
+
+	static void * operator new(size_t n) {
+		return ePool::allocate(n);
+	}
+	static void operator delete(void * p, size_t n) {
+		ePool::deallocate(p, n);
+	}
+};
+
+// offset of the reference counter placed after the blob data
+static inline size_t counterOffset(const unsigned int size) {
+	const size_t a=alignof(std::atomic<int>);
+	return (size+a-1)/a*a;
+}
+
+/*
+ * Binary layout, version 2
+ * 
+ * An 8 byte header (the magic "eBtl", the version, the flags and two 
+ * zero bytes) is followed by the top level list. A list is the amount 
+ * of values and then the values. Each value starts at a multiple of 8 
+ * bytes from the beginning of the buffer with a 4 byte type tag:
+ * 
+ *  - INT: the integer
+ *  - DOUBLE: 4 zero bytes and the double
+ *  - CHARP, STRING: the size in bytes and the bytes
+ *  - INT_ARRAY, DOUBLE_ARRAY: the amount of elements and the elements
+ *  - BOTTLE: the nested list, without header
+ *  - CHARP, STRING with the COMPRESSED bit: the size of the compressed 
+ *    bytes, the size once decompressed and the compressed bytes (see 
+ *    eCompress.h)
+ * 
+ * and is padded with zeros to the next multiple of 8, so doubles and 
+ * array elements are aligned. Numbers are little-endian unless the 
+ * BIG_ENDIAN flag is set.
+ * 
+ * The legacy layout (version 1) has no header, no padding and uses the 
+ * byte order of the host. It is still accepted by fromBinary and read.
+ */
+// the magic, the version and the flags are in eWire.h
+// type tag bit of compressed payloads
+static const int COMPRESSED=0x100;
+static const unsigned int HEADER_SIZE=8;
+// header, amount of values and padding
+static const unsigned int EMPTY_SIZE=16;
+
+static inline unsigned int pad8(const unsigned int n) {
+	return (n+7)&~7u;
+}
+
+// most ints or doubles in a row handed to the kernels at once
+static const unsigned int RUN=64;
+
+static inline void putInt(char * p, const int v, const bool swap) {
+	uint32_t u=v;
+	if (swap) {
+		u=eKernels::swap32(u);
+	}
+	memcpy(p, &u, sizeof(u));
+}
+
+static inline void putDouble(char * p, const double d, const bool swap) {
+	uint64_t u;
+	memcpy(&u, &d, sizeof(u));
+	if (swap) {
+		u=eKernels::swap64(u);
+	}
+	memcpy(p, &u, sizeof(u));
+}
+
+static inline int getInt(const char * p, const bool swap) {
+	uint32_t u;
+	memcpy(&u, p, sizeof(u));
+	if (swap) {
+		u=eKernels::swap32(u);
+	}
+	return (int) u;
+}
+
+static inline double getDouble(const char * p, const bool swap) {
+	uint64_t u;
+	memcpy(&u, p, sizeof(u));
+	if (swap) {
+		u=eKernels::swap64(u);
+	}
+	double d;
+	memcpy(&d, &u, sizeof(d));
+	return d;
+}
+
+// copies blob or array contents between the host and the wire
+static inline void copyArray(char * d, const char * s, const int type, const unsigned int bytes, const bool swap) {
+	if (!swap || type==eValue::CHARP) {
+		eKernels::copy(d, s, bytes);
+	} else if (type==eValue::INT_ARRAY) {
+		eKernels::bswap32(d, s, bytes/sizeof(int));
+	} else {
+		eKernels::bswap64(d, s, bytes/sizeof(double));
+	}
+}
+
+/*
+ * Reading position inside a binary representation of either layout
+ */
+struct eBottle::Cursor {
+	Cursor(const char * q, const int size) {
+		p=q;
+		aligned=(size>=(int) EMPTY_SIZE && memcmp(p, MAGIC, sizeof(MAGIC))==0 && (unsigned char) p[4]==VERSION);
+		swap=aligned && (((p[5] & BIG_ENDIAN_FLAG)!=0)!=hostBigEndian());
+		s=aligned ? HEADER_SIZE : 0;
+		packed=false;
+	}
+	int getInt() {
+		int v=::getInt(p+s, swap);
+		s+=sizeof(int);
+		return v;
+	}
+	double getDouble() {
+		align();
+		double d=::getDouble(p+s, swap);
+		s+=sizeof(double);
+		return d;
+	}
+	void getArray(char * d, const int type, const unsigned int bytes) {
+		copyArray(d, p+s, type, bytes, swap);
+		s+=bytes;
+	}
+	// skips the padding up to the next value
+	void align() {
+		if (aligned) {
+			s=pad8(s);
+		}
+	}
+	bool skipList(const int size, const int depth, std::vector<int> * offsets);
+	bool skipValue(const int size, const int depth);
+	const char * p;
+	int s;
+	bool aligned;
+	bool swap;
+	// whether a compressed payload was decoded, so sizes on the wire are not
+	// the sizes in memory
+	bool packed;
+};
+
+/*
+ * Validation: each step checks that what it is about to read is inside 
+ * the buffer. Payloads are skipped, so the cost depends on the amount 
+ * of values, not on their size.
+ */
+bool eBottle::Cursor::skipList(const int size, const int depth, std::vector<int> * offsets) {
+	if (depth>eBottle::MAX_DEPTH || size-s<(int) sizeof(int)) {
+		return false;
+	}
+	int n=getInt();
+	align();
+	// every value takes at least a type tag, or 8 bytes when aligned
+	const int least=aligned ? 2*sizeof(int) : sizeof(int);
+	if (n<0 || s>size || n>(size-s)/least) {
+		return false;
+	}
+	if (offsets!=NULL) {
+		offsets->reserve(n);
+	}
+	for (int i=0; i<n; i++) {
+		if (offsets!=NULL) {
+			offsets->push_back(s);
+		}
+		if (!skipValue(size, depth)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool eBottle::Cursor::skipValue(const int size, const int depth) {
+	if (size-s<(int) sizeof(int)) {
+		return false;
+	}
+	int type=getInt();
+	switch (type) {
+		case eValue::EMPTY:
+			break;
+		case eValue::INT:
+			if (size-s<(int) sizeof(int)) {
+				return false;
+			}
+			s+=sizeof(int);
+			break;
+		case eValue::DOUBLE:
+			align();
+			if (s>size || size-s<(int) sizeof(double)) {
+				return false;
+			}
+			s+=sizeof(double);
+			break;
+		case eValue::CHARP:
+		case eValue::STRING:
+		case eValue::INT_ARRAY:
+		case eValue::DOUBLE_ARRAY: {
+			if (size-s<(int) sizeof(int)) {
+				return false;
+			}
+			int n=getInt();
+			long long bytes=(long long) n*eValue::elementSize(type);
+			if (n<0 || bytes>size-s) {
+				return false;
+			}
+			if (type==eValue::STRING && (n==0 || memchr(p+s, 0, n)!=p+s+n-1)) {
+				// the string must end exactly at its last byte
+				return false;
+			}
+			s+=(int) bytes;
+			break;
+		}
+		case eValue::BOTTLE:
+			if (!skipList(size, depth+1, NULL)) {
+				return false;
+			}
+			break;
+		case eValue::CHARP|COMPRESSED:
+		case eValue::STRING|COMPRESSED: {
+			if (!aligned || size-s<(int) (2*sizeof(int))) {
+				return false;
+			}
+			int n=getInt();
+			int raw=getInt();
+			if (n<0 || n>size-s || raw<((type==(eValue::STRING|COMPRESSED)) ? 1 : 0) || !eCompress::check(p+s, n, raw)) {
+				return false;
+			}
+			s+=n;
+			break;
+		}
+		default:
+			return false;
+	}
+	align();
+	return s<=size;
+}
+
+void eValue::allocBlob(const unsigned int size_p) {
+	size_t at=counterOffset(size_p);
+	value.blob.data=(char *) ePool::allocate(at+sizeof(std::atomic<int>));
+	value.blob.refs=new (value.blob.data+at) std::atomic<int>(1);
+	size=size_p;
+	flags|=INLINE_COUNT;
 }
-eValue::eValue(const int i) {
-	value=new int(i);
-	type=INT;
+
+eValue::eValue() {
+	type=EMPTY;
+	flags=0;
+	size=0;
+	owner=NULL;
 }
 
 eValue::eValue(const char * text) {
-	value=new std::string(text);
+	if (strlen(text)>=SHARED_STRING) {
+		value.shared=new SharedString(text);
+		flags=SHARED;
+	} else {
+		new (value.text) std::string(text);
+		flags=0;
+	}
 	type=STRING;
+	size=0;
+	owner=NULL;
 }
 
 eValue::eValue(const std::string& s) {
-	value=new std::string(s);
+	if (s.length()>=SHARED_STRING) {
+		value.shared=new SharedString(s);
+		flags=SHARED;
+	} else {
+		new (value.text) std::string(s);
+		flags=0;
+	}
 	type=STRING;
+	size=0;
+	owner=NULL;
 }
 
-eValue::eValue(const double d) {
-	value=new double(d);
-	type=DOUBLE;
+eValue::eValue(std::string && s) {
+	if (s.length()>=SHARED_STRING) {
+		value.shared=new SharedString(std::move(s));
+		flags=SHARED;
+	} else {
+		new (value.text) std::string(std::move(s));
+		flags=0;
+	}
+	type=STRING;
+	size=0;
+	owner=NULL;
 }
+
 eValue::eValue(const char * p, const unsigned int size_p) {
 	type = CHARP;
+	flags = 0;
+	owner = NULL;
+	allocBlob(size_p);
+	memcpy(value.blob.data, p, size);
+}
+
+eValue::eValue(const int * p, const unsigned int n)
+		: eValue(INT_ARRAY, (const char *) p, n*sizeof(int), NULL) {
+}
+
+eValue::eValue(const double * p, const unsigned int n)
+		: eValue(DOUBLE_ARRAY, (const char *) p, n*sizeof(double), NULL) {
+}
+
+eValue::eValue(std::unique_ptr<char[]> p, const unsigned int size_p) {
+	type = CHARP;
+	flags = 0;
 	size = size_p;
-	value = (char *) new char[size];
-	memcpy(value, p, size);
+	owner = NULL;
+	value.blob.refs = new std::atomic<int>(1);
+	value.blob.data = p.release();
+}
+
+eValue::eValue(const unsigned char t, const char * p, const unsigned int size_p, eArena * a) {
+	type = t;
+	owner = NULL;
+	if (a==NULL) {
+		flags = 0;
+		allocBlob(size_p);
+	} else {
+		flags = ARENA;
+		size = size_p;
+		// arrays keep their elements aligned
+		value.blob.data = (char *) a->allocate(size, (t==CHARP) ? 1 : sizeof(double));
+		value.blob.refs = NULL;
+	}
+	if (p!=NULL) {
+		eKernels::copy(value.blob.data, p, size);
+	}
 }
 
 eValue::eValue(const eBottle * p) {
-	this->value = (char *)p;
+	value.list.ptr = (eBottle *)p;
+	type = BOTTLE;
+	flags = 0;
+	size = 0;
+	owner = NULL;
+}
+
+eValue::eValue(eBottle * p, eArena * a) {
+	value.list.ptr = p;
 	type = BOTTLE;
+	flags = (a!=NULL) ? ARENA : 0;
+	size = 0;
+	owner = NULL;
+}
+
+eValue::eValue(const eValue & p) {
+	type=EMPTY;
+	flags=0;
+	size=0;
+	owner=NULL;
+	*this=p;
 }
-int eValue::asInt() const {
-	return *(int*) this->value;
+
+eValue::eValue(eValue && p) {
+	type=EMPTY;
+	flags=0;
+	size=0;
+	owner=NULL;
+	*this=std::move(p);
+}
+
+std::string * eValue::str() const {
+	if (flags & SHARED) {
+		return &value.shared->s;
+	}
+	return (std::string*) value.text;
 }
-double eValue::asDouble() const {
-	return *(double*)value;
+
+// gives a blob, array or list its own copy of the data
+void eValue::detach() {
+	if (isBlock() && value.blob.refs!=NULL && *value.blob.refs>1) {
+		// copy on write
+		eValue tmp(type, value.blob.data, size, NULL);
+		*this=std::move(tmp);
+	} else if (type==BOTTLE && !(flags & ARENA) && value.list.ptr->refs>1) {
+		// copy on write, sharing the next level
+		eBottle * c=new eBottle();
+		c->copy(value.list.ptr);
+		if (--value.list.ptr->refs==0) {
+			delete value.list.ptr;
+		}
+		value.list.ptr=c;
+	}
 }
 
 char * eValue::asBlob() {
-	return (char*) value;
+	changing();
+	detach();
+	return value.blob.data;
 }
 
-char * eValue::asBlob() const {
-	return (char*) value;
+const char * eValue::asBlob() const {
+	return value.blob.data;
 }
 
-eBottle * eValue::asList() const {
-	return (eBottle*) value;
+const eBottle * eValue::asList() const {
+	return value.list.ptr;
 }
 
 eBottle * eValue::asList() {
-	return (eBottle*) value;
+	if (type!=BOTTLE || (flags & ARENA)) {
+		return value.list.ptr;
+	}
+	changing();
+	detach();
+	value.list.ptr->parent=owner;
+	value.list.ptr->expose();
+	return value.list.ptr;
 }
 
 yarp::os::ConstString eValue::asString() const {
-	ConstString cs( ((std::string*) value)->c_str());
+	ConstString cs(str()->c_str());
 	return cs;
 }
 
 int* eValue::asIntPtr()  {
-	return (int*) value;
+	changing();
+	return &value.i;
 }
 
-int* eValue::asIntPtr()  const {
-	return (int*) value;
+const int* eValue::asIntPtr()  const {
+	return &value.i;
 }
 
 double* eValue::asDoublePtr()  {
-	return (double*) value;
+	changing();
+	return &value.d;
 }
 
-double* eValue::asDoublePtr() const {
-	return (double*) value;
+const double* eValue::asDoublePtr() const {
+	return &value.d;
 }
 
 std::string* eValue::asStringPtr()  {
-	return (std::string*) value;
+	changing();
+	if (type==STRING && (flags & SHARED) && value.shared->refs>1) {
+		// copy on write
+		SharedString * s=new SharedString(value.shared->s);
+		if (--value.shared->refs==0) {
+			delete value.shared;
+		}
+		value.shared=s;
+	}
+	if (owner!=NULL) {
+		owner->loosen();
+	}
+	return str();
 }
 
 /*ConstString* eValue::asStringPtr() const {
@@ -126,32 +726,106 @@ unsigned int eValue::asBlobLength() const {
 	return size;
 }
 
-eValue::ValueType eValue::getType() const {
-	return type;
+int * eValue::asIntArray() {
+	changing();
+	detach();
+	return (int *) value.blob.data;
+}
+
+const int * eValue::asIntArray() const {
+	return (const int *) value.blob.data;
+}
+
+double * eValue::asDoubleArray() {
+	changing();
+	detach();
+	return (double *) value.blob.data;
+}
+
+const double * eValue::asDoubleArray() const {
+	return (const double *) value.blob.data;
+}
+
+unsigned int eValue::asArrayLength() const {
+	return size/elementSize(type);
+}
+
+void eValue::asFloatArray(float * f) const {
+	eKernels::narrow(f, value.blob.data, asArrayLength());
+}
+
+unsigned int eValue::elementSize(const int t) {
+	switch (t) {
+		case INT_ARRAY:
+			return sizeof(int);
+		case DOUBLE_ARRAY:
+			return sizeof(double);
+		default:
+			return 1;
+	}
 }
 
 unsigned int eValue::getSize() const {
 	return size;
 }
 
-eValue::~eValue() {
+void eValue::release() {
 	switch (type) {
 		case CHARP:
-			delete [] ((char*) value);
-			break;
-		case INT:
-			delete (int*) value;
-			break;
-		case DOUBLE:
-			delete (double*) value;
+		case INT_ARRAY:
+		case DOUBLE_ARRAY:
+			if (value.blob.refs!=NULL && --(*value.blob.refs)==0) {
+				if (flags & INLINE_COUNT) {
+					// from allocBlob
+					ePool::deallocate(value.blob.data, counterOffset(size)+sizeof(std::atomic<int>));
+				} else {
+					delete value.blob.refs;
+					delete [] value.blob.data;
+				}
+			}
 			break;
 		case BOTTLE:
-			delete (eBottle*) value;
+			if (flags & ARENA) {
+				value.list.ptr->~eBottle();
+				break;
+			}
+			if (--value.list.ptr->refs==0) {
+				delete value.list.ptr;
+			}
 			break;
 		case STRING:
-			delete (std::string*) value;
+			if (flags & SHARED) {
+				if (--value.shared->refs==0) {
+					delete value.shared;
+				}
+			} else {
+				str()->~basic_string();
+			}
+			break;
+		default:
 			break;
 	}
+	type=EMPTY;
+	flags=0;
+}
+
+eValue::~eValue() {
+	release();
+}
+
+void * eValue::operator new(size_t n) {
+	return ePool::allocate(n);
+}
+
+void * eValue::operator new(size_t, void * p) {
+	return p;
+}
+
+void eValue::operator delete(void * p, size_t n) {
+	ePool::deallocate(p, n);
+}
+
+void eValue::operator delete(void *, void *) {
 }
 
 bool eValue::isString() const {
@@ -172,35 +846,136 @@ bool eValue::isDouble() const {
 	return type==DOUBLE;
 }
 
+bool eValue::isIntArray() const {
+	return type==INT_ARRAY;
+}
+
+bool eValue::isDoubleArray() const {
+	return type==DOUBLE_ARRAY;
+}
+
+// blobs and arrays share the same storage
+bool eValue::isBlock() const {
+	return type==CHARP || type==INT_ARRAY || type==DOUBLE_ARRAY;
+}
+
+bool eValue::isShared() const {
+	switch (type) {
+		case CHARP:
+		case INT_ARRAY:
+		case DOUBLE_ARRAY:
+			return value.blob.refs!=NULL && *value.blob.refs>1;
+		case BOTTLE:
+			return !(flags & ARENA) && value.list.ptr->refs>1;
+		case STRING:
+			return (flags & SHARED) && value.shared->refs>1;
+		default:
+			return false;
+	}
+}
+
 eValue * eValue::makeBlob(const char* p, const unsigned int size) {
 	return new eValue(p,size);
 }
 
 eValue & eValue::operator=(const eValue & p) {
-	this->type=p.getType();
+	if (this==&p) {
+		return *this;
+	}
+	changing();
+	const unsigned int before=(owner!=NULL) ? eBottle::binaryLength(this) : 0;
+	release();
 	this->size=p.getSize();
-	switch(this->type) {
+	switch(p.getType()) {
 		case INT:
-		value = new int(p.asInt());
+		value.i = p.asInt();
 		break;
 		case BOTTLE:
-		value = new eBottle();
-		(*(eBottle*)value) = *(p.asList());
+		if ((p.flags & ARENA) || p.value.list.ptr->exposed) {
+			// the arena of the source may go away before this eValue, and 
+			// a list handed out may be written through a pointer at any time
+			value.list.ptr = new eBottle();
+			value.list.ptr->copy(p.value.list.ptr);
+		} else {
+			value.list.ptr = p.value.list.ptr;
+			value.list.ptr->refs++;
+		}
 		break;
 		case DOUBLE:
-		value = new double(p.asDouble());
+		value.d = p.asDouble();
 		break;
 		case CHARP:
-		value = new char[this->size];
-		memcpy((char*)value,p.asBlob(),p.getSize());
+		case INT_ARRAY:
+		case DOUBLE_ARRAY:
+		if (p.value.blob.refs==NULL) {
+			allocBlob(p.getSize());
+			memcpy(value.blob.data,p.asBlob(),p.getSize());
+		} else {
+			value.blob=p.value.blob;
+			(*value.blob.refs)++;
+			flags=p.flags & INLINE_COUNT;
+		}
 		break;
 		case STRING:
-		value = new std::string(p.asString());
+		if (p.flags & SHARED) {
+			value.shared = p.value.shared;
+			value.shared->refs++;
+			this->flags=SHARED;
+		} else {
+			new (value.text) std::string(*p.str());
+		}
+		break;
+		default:
 		break;
 	}
+	this->type=p.getType();
+	resized(before);
+	return *this;
+}
+
+eValue & eValue::operator=(eValue && p) {
+	if (this==&p) {
+		return *this;
+	}
+	if (p.flags & ARENA) {
+		// the arena of the source may go away before this eValue
+		return *this=p;
+	}
+	changing();
+	p.changing();
+	const unsigned int before=(owner!=NULL) ? eBottle::binaryLength(this) : 0;
+	const unsigned int given=(p.owner!=NULL) ? eBottle::binaryLength(&p) : 0;
+	release();
+	size=p.size;
+	flags=p.flags;
+	type=p.type;
+	if (type==STRING && !(flags & SHARED)) {
+		new (value.text) std::string(std::move(*p.str()));
+		p.release();
+	} else {
+		value=p.value;
+		if (type==BOTTLE && value.list.ptr->refs==1 && value.list.ptr->parent==p.owner) {
+			// the list now belongs where this eValue is
+			value.list.ptr->parent=owner;
+			if (owner!=NULL && value.list.ptr->exposed) {
+				owner->expose();
+			}
+		}
+		p.type=EMPTY;
+		p.flags=0;
+	}
+	resized(before);
+	p.resized(given);
 	return *this;
 }
 
+// tells the eBottle holding this eValue that it took before bytes
+void eValue::resized(const unsigned int before) {
+	if (owner!=NULL) {
+		owner->grow(eBottle::binaryLength(this)-before);
+	}
+}
+
 std::string eBottle::content() const {
 	std::string cont;
 	for (unsigned int i = 0; i<values.size(); i++) {
@@ -212,444 +987,3161 @@ std::string eBottle::content() const {
 }
 
 eBottle::eBottle() {
-	toBinaryPointer=NULL;
+	init(NULL);
 }
 
-void eBottle::clear() {
-	for (unsigned int i=0; i<values.size(); i++) {
-		delete values.at(i);
-	}
-	delete toBinaryPointer;
-	values.clear();
+eBottle::eBottle(eArena * a) {
+	init(a);
 }
-unsigned int eBottle::count() const {
-	return values.size();
+
+void eBottle::init(eArena * a) {
+	global_size=EMPTY_SIZE;
+	dirty=false;
+	parent=NULL;
+	refs=1;
+	exposed=false;
+	revision=0;
+	indexed=0;
+	loose=false;
+	toBinaryPointer=NULL;
+	arena=a;
+	ownArena=false;
+	rxBuffer=NULL;
+	rxDecoder=NULL;
+	rxCapacity=0;
+	rxSize=0;
+	viewMode=false;
+	bigEndian=false;
+	compression=0;
+	parallel=0;
+	values=std::vector< eValue *, eArenaAllocator<eValue *> >(eArenaAllocator<eValue *>(a));
 }
-unsigned int eBottle::size() const {
-	return values.size();
+
+void eBottle::freeValue(eValue * v) {
+	if (arena!=NULL) {
+		v->~eValue();
+	} else {
+		delete v;
+	}
 }
 
-eBottle::~eBottle() {
+void eBottle::destroyValues() {
+	indexed=0;
+	if (ownArena && arena->live==0) {
+		// nothing in the arena needs a destructor: just rewind it
+		values=std::vector< eValue *, eArenaAllocator<eValue *> >(eArenaAllocator<eValue *>(arena));
+		arena->reset();
+		return;
+	}
 	for (unsigned int i=0; i<values.size(); i++) {
-		delete values.at(i);
+		freeValue(values[i]);
+	}
+	if (arena==NULL) {
+		// the list keeps its capacity for the next message
+		values.clear();
+		return;
+	}
+	values=std::vector< eValue *, eArenaAllocator<eValue *> >(eArenaAllocator<eValue *>(arena));
+	if (ownArena) {
+		arena->reset();
 	}
-	delete toBinaryPointer;
-}
-void eBottle::addInt(const int i) {
-	eValue * p = new eValue(i);
-	values.push_back(p);
 }
 
-void eBottle::addString(const std::string& s) {
-	eValue * p = new eValue(s.c_str());
-	values.push_back(p);
+void eBottle::touch() {
+	for (eBottle * b=this; b!=NULL && !b->dirty; b=b->parent) {
+		b->dirty=true;
+	}
 }
 
-void eBottle::addString(const ConstString& s) {
-	eValue * p = new eValue(s.c_str());
-	values.push_back(p);
+// a string was handed out as a pointer, so it may change size at any time
+void eBottle::loosen() {
+	touch();
+	for (eBottle * b=this; b!=NULL && !b->loose; b=b->parent) {
+		b->loose=true;
+	}
 }
 
-void eBottle::addString(const char * s) {
-	eValue * p = new eValue(s);
-	values.push_back(p);
+// a list was handed out to be written in place, so copies may not share it
+void eBottle::expose() {
+	for (eBottle * b=this; b!=NULL && !b->exposed; b=b->parent) {
+		b->exposed=true;
+	}
+}
+
+void eBottle::dropIndexes() {
+	indexed=0;
+	for (unsigned int i=0; i<values.size(); i++) {
+		if (values[i]->type==eValue::BOTTLE) {
+			values[i]->value.list.ptr->dropIndexes();
+		}
+	}
+}
+
+unsigned int eBottle::binaryLength(const eValue * v) {
+	switch (v->getType()) {
+		case eValue::INT:
+			return 2*sizeof(int);
+		case eValue::DOUBLE:
+			return 2*sizeof(double);
+		case eValue::CHARP:
+		case eValue::INT_ARRAY:
+		case eValue::DOUBLE_ARRAY:
+			return 2*sizeof(int)+pad8(v->getSize());
+		case eValue::BOTTLE:
+			// the header of the list is replaced by the type tag
+			return v->asList()->getBinarySize()-HEADER_SIZE;
+		case eValue::STRING:
+			return 2*sizeof(int)+pad8(v->str()->length()+1);
+		default:
+			return 2*sizeof(int);
+	}
+}
+
+void eBottle::clear() {
+	changing();
+	if (dirty) {
+		// the ancestors are dirty too and will recompute
+		dirty=false;
+		global_size=EMPTY_SIZE;
+	} else {
+		grow(EMPTY_SIZE-global_size);
+	}
+	destroyValues();
+	// the strings handed out went with their eValues
+	loose=false;
+	delete [] toBinaryPointer;
+	toBinaryPointer=NULL;
+}
+
+void eBottle::useArena(const bool enable) {
+	clear();
+	if (ownArena) {
+		delete arena;
+	}
+	// still the same list for the eValues holding it
+	eBottle * p=parent;
+	const int r=refs;
+	const bool e=exposed;
+	const unsigned int n=revision;
+	// and the same receive buffers
+	char * b=rxBuffer;
+	const unsigned int c=rxCapacity;
+	eBottleDecoder * d=rxDecoder;
+	init(enable ? new eArena() : NULL);
+	ownArena=enable;
+	parent=p;
+	refs=r;
+	exposed=e;
+	revision=n;
+	rxBuffer=b;
+	rxCapacity=c;
+	rxDecoder=d;
+}
+
+bool eBottle::isArena() const {
+	return arena!=NULL;
+}
+unsigned int eBottle::count() const {
+	return values.size();
+}
+unsigned int eBottle::size() const {
+	return values.size();
+}
+
+eBottle::~eBottle() {
+	if (!ownArena || arena->live>0) {
+		for (unsigned int i=0; i<values.size(); i++) {
+			freeValue(values[i]);
+		}
+	}
+	delete [] toBinaryPointer;
+	delete [] rxBuffer;
+	delete rxDecoder;
+	if (ownArena) {
+		// the vector memory belongs to the arena
+		values=std::vector< eValue *, eArenaAllocator<eValue *> >();
+		delete arena;
+	}
+}
+
+void * eBottle::operator new(size_t n) {
+	return ePool::allocate(n);
+}
+
+void * eBottle::operator new(size_t, void * p) {
+	return p;
+}
+
+void eBottle::operator delete(void * p, size_t n) {
+	ePool::deallocate(p, n);
+}
+
+void eBottle::operator delete(void *, void *) {
+}
+void eBottle::addInt(const int i) {
+	changing();
+	eValue * p = new (allocValue()) eValue(i);
+	values.push_back(p);
+	grow(2*sizeof(int));
+}
+
+void eBottle::addString(const std::string& s) {
+	addString(s.c_str());
+}
+
+void eBottle::addString(std::string&& s) {
+	if (arena!=NULL) {
+		addString(s.c_str());
+		return;
+	}
+	changing();
+	eValue * p = new eValue(std::move(s));
+	values.push_back(p);
+	grow(binaryLength(p));
+}
+
+void eBottle::addString(const ConstString& s) {
+	addString(s.c_str());
+}
+
+void eBottle::addString(const char * s) {
+	changing();
+	eValue * p = new (allocValue()) eValue(s);
+	values.push_back(p);
+	grow(binaryLength(p));
+	if (arena!=NULL) {
+		arena->live++;
+	}
 }
 void eBottle::addDouble(const double d) {
-	eValue * p = new eValue(d);
+	changing();
+	eValue * p = new (allocValue()) eValue(d);
 	values.push_back(p);
+	grow(2*sizeof(double));
 }
-void eBottle::addBlob(const char * q, const unsigned int size) {
-	eValue * p = new eValue(q,size);
+// q may be NULL to fill the block afterwards
+eValue * eBottle::addBlock(const unsigned char type, const char * q, const unsigned int size) {
+	changing();
+	eValue * p = new (allocValue()) eValue(type,q,size,arena);
 	values.push_back(p);
+	grow(binaryLength(p));
+	return p;
+}
+void eBottle::addBlob(const char * q, const unsigned int size) {
+	addBlock(eValue::CHARP, q, size);
+}
+void eBottle::addIntArray(const int * q, const unsigned int n) {
+	addBlock(eValue::INT_ARRAY, (const char *) q, n*sizeof(int));
+}
+void eBottle::addDoubleArray(const double * q, const unsigned int n) {
+	addBlock(eValue::DOUBLE_ARRAY, (const char *) q, n*sizeof(double));
+}
+void eBottle::addDoubleArray(const float * q, const unsigned int n) {
+	eValue * p = addBlock(eValue::DOUBLE_ARRAY, NULL, n*sizeof(double));
+	eKernels::widen(p->value.blob.data, q, n);
+}
+void eBottle::addBlob(std::unique_ptr<char[]> q, const unsigned int size) {
+	if (arena!=NULL) {
+		addBlob(q.get(), size);
+		return;
+	}
+	changing();
+	values.push_back(new eValue(std::move(q), size));
+	grow(binaryLength(values.back()));
 }
+
 eBottle * eBottle::addListPtr() {
-	eBottle* yb= new eBottle();
-	eValue * p = new eValue(yb);
+	eBottle * yb=newList();
+	yb->expose();
+	return yb;
+}
+
+// a nested list that is only filled here
+eBottle * eBottle::newList() {
+	changing();
+	eBottle* yb;
+	if (arena!=NULL) {
+		yb = new (arena->allocate(sizeof(eBottle))) eBottle(arena);
+	} else {
+		yb = new eBottle();
+	}
+	eValue * p = new (allocValue()) eValue(yb, arena);
+	p->owner=this;
+	values.push_back(p);
+	yb->parent=this;
+	grow(2*sizeof(int));
+	return yb;
+}
+
+eBottle & eBottle::addList() {
+	return *addListPtr();
+}
+
+eBottle & eBottle::addList(eBottle && b) {
+	if (arena!=NULL) {
+		eBottle * yb=addListPtr();
+		yb->copy(&b);
+		b.clear();
+		return *yb;
+	}
+	eBottle * yb=new eBottle(std::move(b));
+	adopt(new eValue(yb, NULL));
+	yb->expose();
+	return *yb;
+}
+
+void eBottle::add(const eValue* yv) {
+	add(*yv);
+}
+
+// appends a node created for this eBottle
+void eBottle::adopt(eValue * p) {
+	changing();
+	p->owner=this;
+	if (p->type==eValue::BOTTLE && p->value.list.ptr->refs==1) {
+		p->value.list.ptr->parent=this;
+		if (p->value.list.ptr->exposed) {
+			expose();
+		}
+	}
 	values.push_back(p);
-	return (eBottle*) yb;
+	grow(binaryLength(p));
+}
+
+void eBottle::add(eValue && yv) {
+	if (arena==NULL) {
+		adopt(new eValue(std::move(yv)));
+	} else {
+		add(yv);
+		yv=eValue();
+	}
+}
+
+void eBottle::add(const eValue & yv) {
+	if (arena==NULL || yv.type==eValue::INT || yv.type==eValue::DOUBLE) {
+		// payloads are shared, see eValue::operator=
+		adopt(new (allocValue()) eValue(yv));
+		return;
+	}
+	// nothing in an arena is shared
+	switch (yv.getType()) {
+		case eValue::CHARP:
+		case eValue::INT_ARRAY:
+		case eValue::DOUBLE_ARRAY:
+			addBlock(yv.type, yv.asBlob(), yv.getSize());
+			break;
+		case eValue::BOTTLE:
+			*addListPtr() = *yv.asList();
+			break;
+		case eValue::STRING:
+			addString(yv.str()->c_str());
+			break;
+		default:
+			adopt(new (allocValue()) eValue());
+			break;
+	}
+}
+
+eValue * eBottle::getPtr(const unsigned int i) {
+	eValue * v=values.at(i);
+	// assigning it keeps the size of this eBottle
+	v->owner=this;
+	return v;
+}
+
+const eValue * eBottle::getPtr(const unsigned int i) const {
+	return values.at(i);
+}
+
+eValue & eBottle::get(const unsigned int i) {
+	return *getPtr(i);
+}
+
+const eValue & eBottle::get(const unsigned int i) const {
+	return *values.at(i);
+}
+
+/*
+ * Key lookup
+ * 
+ * A value is keyed by a string when it is that string and not the last 
+ * value ("key value"), or when it is a list that starts with the string 
+ * ("(key value)"). Positions are coded as 2*i, or 2*i+1 for lists.
+ * 
+ * The index is an open addressing table with the code of the first value 
+ * keyed by each string, of each kind. It keeps the revision of the eBottle 
+ * it was built at, which any later change in it or in its lists moves 
+ * through changing(). Lookups in several threads build it once, under one 
+ * of a few locks picked by the address of the eBottle.
+ */
+static inline bool sameKey(const std::string * k, const char * key, const size_t n) {
+	return k!=NULL && k->length()==n && memcmp(k->data(), key, n)==0;
+}
+
+static inline int codeOf(const eValue * v, const unsigned int i) {
+	return 2*i+(v->getType()==eValue::BOTTLE ? 1 : 0);
+}
+
+// the key of a value, NULL if it is not keyed
+const std::string * eBottle::keyOf(const eBottle * b, const int code) {
+	const unsigned int i=code>>1;
+	const eValue * v=b->values[i];
+	if ((code & 1)!=0) {
+		const eBottle * l=v->value.list.ptr;
+		if (l->values.empty()) {
+			return NULL;
+		}
+		v=l->values[0];
+	} else if (i+1>=b->values.size()) {
+		return NULL;
+	}
+	return (v->type==eValue::STRING) ? v->str() : NULL;
+}
+
+static std::mutex & indexLock(const eBottle * b) {
+	static std::mutex locks[64];
+	return locks[((uintptr_t) b/sizeof(eBottle))%64];
+}
+
+void eBottle::buildIndex() const {
+	std::lock_guard<std::mutex> lock(indexLock(this));
+	if (indexed.load(std::memory_order_relaxed)==revision+1) {
+		// built by another thread meanwhile
+		return;
+	}
+	unsigned int size=4;
+	while (size<2*values.size()) {
+		size<<=1;
+	}
+	keyIndex.assign(size, -1);
+	const unsigned int mask=size-1;
+	for (unsigned int i=0; i<values.size(); i++) {
+		const int code=codeOf(values[i], i);
+		const std::string * k=keyOf(this, code);
+		if (k==NULL) {
+			continue;
+		}
+		unsigned int s=fnv1a(k->data(), k->length()) & mask;
+		while (keyIndex[s]>=0 && ((keyIndex[s]^code) & 1 || *keyOf(this, keyIndex[s])!=*k)) {
+			s=(s+1) & mask;
+		}
+		if (keyIndex[s]<0) {
+			keyIndex[s]=code;
+		}
+	}
+	indexed.store(revision+1, std::memory_order_release);
+}
+
+// the code of the first value keyed by key, only lists if group, or -1
+int eBottle::locate(const char * key, const size_t n, const bool group) const {
+	if (values.size()<INDEX_THRESHOLD) {
+		for (unsigned int i=0; i<values.size(); i++) {
+			const int code=codeOf(values[i], i);
+			if ((!group || (code & 1)!=0) && sameKey(keyOf(this, code), key, n)) {
+				return code;
+			}
+		}
+		return -1;
+	}
+	if (indexed.load(std::memory_order_acquire)!=revision+1) {
+		buildIndex();
+	}
+	const unsigned int mask=keyIndex.size()-1;
+	int found=-1;
+	for (unsigned int s=fnv1a(key, n) & mask; keyIndex[s]>=0; s=(s+1) & mask) {
+		const int code=keyIndex[s];
+		if ((!group || (code & 1)!=0) && (found<0 || code<found) && sameKey(keyOf(this, code), key, n)) {
+			found=code;
+		}
+	}
+	return found;
+}
+
+const eValue * eBottle::find(const char * key) const {
+	const int code=locate(key, strlen(key), false);
+	if (code<0) {
+		return NULL;
+	}
+	if ((code & 1)!=0) {
+		const eBottle * l=values[code>>1]->value.list.ptr;
+		return (l->values.size()>1) ? l->values[1] : NULL;
+	}
+	return values[(code>>1)+1];
+}
+
+bool eBottle::check(const char * key) const {
+	return find(key)!=NULL;
+}
+
+const eBottle * eBottle::findGroup(const char * key) const {
+	const int code=locate(key, strlen(key), true);
+	return (code<0) ? NULL : values[code>>1]->value.list.ptr;
+}
+
+const eValue * eBottle::findPath(const char * path) const {
+	const eBottle * b=this;
+	const char * p=path;
+	for (const char * dot=strchr(p, '.'); dot!=NULL; p=dot+1, dot=strchr(p, '.')) {
+		const int code=b->locate(p, dot-p, true);
+		if (code<0) {
+			return NULL;
+		}
+		b=b->values[code>>1]->value.list.ptr;
+	}
+	return b->find(p);
+}
+
+/*
+ * Compression happens before a message is sent, as its size goes first. 
+ * pack() compresses the payloads into one buffer, and fill() takes them 
+ * in the same order, using packedSize() to know which.
+ */
+struct eBottle::Packing {
+	Packing(const unsigned int t, const unsigned int e=UINT_MAX) : threshold(t), next(0), at(0), end(e), overflow(false) {}
+	const unsigned int threshold;
+	// next entry of packedSizes, and where its bytes are in packed
+	unsigned int next;
+	unsigned int at;
+	// the end of the buffer, and whether a value did not fit before it
+	const unsigned int end;
+	bool overflow;
+};
+
+// bytes of a blob or string payload, 0 for other values
+unsigned int eBottle::payloadSize(const eValue * v) {
+	switch (v->getType()) {
+		case eValue::CHARP:
+			return v->getSize();
+		case eValue::STRING:
+			return v->str()->length()+1;
+		default:
+			return 0;
+	}
+}
+
+bool eBottle::write(ConnectionWriter& connection) {
+	int size=expectedSize();
+	if (compression==0 && isParallel(size)) {
+		// written whole, and sent from there as the big payloads are
+		const char * p=toBinary(&size);
+		connection.appendInt(size);
+		connection.appendExternalBlock(p, size);
+		return true;
+	}
+	Packing k(compression);
+	if (compression>0) {
+		size-=pack(this);
+	}
+	connection.appendInt(size);
+//	fprintf(stderr,"TX SIZE: %d\n",size);
+	char scratch[EXTERNAL_BLOCK];
+	int used=header(scratch);
+	fill(this, connection, scratch, used, bigEndian!=hostBigEndian(), k);
+	if (used>0) {
+		connection.appendBlock(scratch, used);
+	}
+	return true;
+}
+
+bool eBottle::read(ConnectionReader& connection) {
+	int size=connection.expectInt();
+//	fprintf(stderr,"RX SIZE: %d\n",size);
+	if (size<0) {
+		return false;
+	}
+	if (size>STREAM_CHUNK && !viewMode && !isParallel(size)) {
+		return stream(connection, size);
+	}
+	if ((unsigned int) size>rxCapacity) {
+		delete [] rxBuffer;
+		rxBuffer=new char[size];
+		rxCapacity=size;
+	}
+	connection.expectBlock(rxBuffer, size);
+	rxSize=size;
+	if (connection.isError() || !validate(rxBuffer, size, &rxOffsets)) {
+		rxSize=0;
+		rxOffsets.clear();
+		this->clear();
+		return false;
+	}
+	if (viewMode) {
+		if (!values.empty()) {
+			this->clear();
+		}
+		return true;
+	}
+	load(rxBuffer, size, &rxOffsets);
+	return true;
+}
+
+// replaces the contents with a valid binary representation, whose top 
+// level values start at the offsets if they are given
+void eBottle::load(const char * p, const int size, const std::vector<int> * offsets) {
+	changing();
+	Cursor c(p, size);
+	if (offsets!=NULL && isParallel(size)) {
+		if (!c.aligned) {
+			this->clear();
+		}
+		decodeParallel(p, size, *offsets, c.aligned);
+	} else if (c.aligned) {
+		// reuse the eValues of the previous message where the shape matches
+		update(this, c);
+	} else {
+		this->clear();
+		reconstruct(this, c);
+	}
+	if (parent!=NULL) {
+		parent->touch();
+	}
+}
+
+/*
+ * The decoder keeps only the bytes of the values not decoded yet, so a 
+ * message takes about a chunk plus its biggest value, not its size. No 
+ * bytes are kept for view(). It is kept for the next message, whose 
+ * buffer and stack reuse its memory.
+ */
+bool eBottle::stream(ConnectionReader& connection, const int size) {
+	rxSize=0;
+	rxOffsets.clear();
+	if (rxDecoder==NULL) {
+		rxDecoder=new eBottleDecoder(*this);
+	}
+	eBottleDecoder & d=*rxDecoder;
+	d.begin(size);
+	while (d.status()==eBottleDecoder::MORE) {
+		d.receive(connection, (d.remaining()<STREAM_CHUNK) ? d.remaining() : STREAM_CHUNK);
+	}
+	if (d.status()!=eBottleDecoder::DONE) {
+		// the rest of the message is dropped, so the next one can be read
+		std::vector<char> rest((d.remaining()<STREAM_CHUNK) ? d.remaining() : STREAM_CHUNK);
+		for (int left=d.remaining(); left>0 && !connection.isError(); left-=rest.size()) {
+			connection.expectBlock(&rest[0], (left<(int) rest.size()) ? left : rest.size());
+		}
+		this->clear();
+		return false;
+	}
+	if (parent!=NULL) {
+		parent->touch();
+	}
+	return true;
+}
+
+void eBottle::remove(const unsigned int i) {
+	changing();
+	if (!dirty) {
+		grow(-(int) binaryLength(values.at(i)));
+	}
+	freeValue(values.at(i));
+	values.erase(values.begin()+i);
+}
+
+void eBottle::insert(const eValue *p, const unsigned int i) {
+	add(p);
+	eValue * yv=values.back();
+	values.pop_back();
+	values.insert(values.begin()+i, yv);
+}
+eBottle & eBottle::operator=(const eBottle & p) {
+	copy(&p);
+	return *this;
+}
+
+void eBottle::copy(const eBottle *p) {
+	if (this==p) {
+		return;
+	}
+	this->clear();
+	if (arena!=NULL && p->arena!=NULL) {
+		// the copy is written in pre-order to a single chunk
+		arena->reserve(p->arena->used());
+	}
+	values.reserve(p->values.size());
+	for (unsigned int i=0; i<p->values.size(); i++) {
+		add(*p->values[i]);
+	}
+}
+
+const char * const eBottle::toBinary(int *size) const {
+	const unsigned int room=expectedSize();
+	delete [] toBinaryPointer;
+	toBinaryPointer = new char[room];
+	if (arena!=NULL && !ownArena) {
+		// nested lists in an arena only free this when visited
+		arena->live++;
+	}
+	int s=encode(toBinaryPointer, room);
+	if (s<0) {
+		// it grew through an eValue the cache does not follow, and was measured
+		delete [] toBinaryPointer;
+		toBinaryPointer = new char[getBinarySize()];
+		s=encode(toBinaryPointer, getBinarySize());
+	}
+	*size=s;
+	return toBinaryPointer;
+}
+
+/*
+ * Writes the message in a single pass, trusting the cached sizes. Values 
+ * changed through something the cache does not follow are caught by 
+ * checking each write against the end of the buffer and the size against 
+ * the cache: the sizes are measured then, and -1 returned if the message 
+ * did not fit in room bytes.
+ */
+int eBottle::encode(char * p, const unsigned int room) const {
+	const bool swap=bigEndian!=hostBigEndian();
+	Packing k(compression, room);
+	const unsigned int saved=(compression>0) ? pack(this) : 0;
+	int s=header(p);
+	if (!fillParallel(s, p, swap, k)) {
+		fill(this, s, p, swap, k);
+	}
+	if (k.overflow || s+saved!=getBinarySize()) {
+		measure();
+	}
+	return k.overflow ? -1 : s;
+}
+
+// the size of the message, measured if strings were handed out as pointers
+unsigned int eBottle::expectedSize() const {
+	return loose ? measure() : getBinarySize();
+}
+
+unsigned int eBottle::getBinarySize() const {
+	if (dirty) {
+		unsigned int s=EMPTY_SIZE;
+		for (unsigned int i=0; i<values.size(); i++) {
+			s+=binaryLength(values[i]);
+		}
+		global_size=s;
+		dirty=false;
+	}
+	return global_size;
+}
+
+/*
+ * The size computed again from the contents of every nested list, for 
+ * when the cache may be wrong: strings may have been changed through 
+ * pointers, and eValues through the const accessors.
+ */
+unsigned int eBottle::measure() const {
+	unsigned int s=EMPTY_SIZE;
+	for (unsigned int i=0; i<values.size(); i++) {
+		const eValue * v=values[i];
+		if (v->type==eValue::BOTTLE) {
+			s+=v->value.list.ptr->measure()-HEADER_SIZE;
+		} else {
+			s+=binaryLength(v);
+		}
+	}
+	// lists shared by copies in other threads are only read if unchanged
+	if (dirty || s!=global_size) {
+		if (!dirty && parent!=NULL) {
+			parent->touch();
+		}
+		global_size=s;
+		dirty=false;
+	}
+	return s;
+}
+int eBottle::toBinary(char * p) const {
+	// the buffer was sized by getBinarySize()
+	const unsigned int room=getBinarySize();
+	if (loose && measure()>room) {
+		return -1;
+	}
+	return encode(p, room);
+}
+
+bool eBottle::fromBinary(const char * p, const int size) {
+	changing();
+	if (isParallel(size)) {
+		std::vector<int> offsets;
+		if (!validate(p, size, &offsets)) {
+			return false;
+		}
+		decodeParallel(p, size, offsets, false);
+		return true;
+	}
+	if (!validate(p, size, NULL)) {
+		return false;
+	}
+	Cursor c(p, size);
+	reconstruct(this, c);
+	return true;
+}
+
+bool eBottle::validate(const char * p, const int size) {
+	return validate(p, size, NULL);
+}
+
+bool eBottle::validate(const char * p, const int size, std::vector<int> * offsets) {
+	if (p==NULL || size<(int) sizeof(int)) {
+		return false;
+	}
+	Cursor c(p, size);
+	if (!c.aligned && size>=(int) HEADER_SIZE && memcmp(p, MAGIC, sizeof(MAGIC))==0) {
+		// a version this code does not know
+		return false;
+	}
+	if (c.aligned && (p[5] & ~BIG_ENDIAN_FLAG)!=0) {
+		// a delta stream, or flags this code does not know
+		return false;
+	}
+	if (offsets!=NULL) {
+		offsets->clear();
+	}
+	return c.skipList(size, 0, offsets) && c.s==size;
+}
+
+void eBottle::setBigEndian(const bool enable) {
+	bigEndian=enable;
+}
+
+bool eBottle::isBigEndian() const {
+	return bigEndian;
+}
+
+void eBottle::setCompression(const unsigned int threshold) {
+	compression=threshold;
+}
+
+unsigned int eBottle::getCompression() const {
+	return compression;
+}
+
+void eBottle::setParallel(const unsigned int threshold) {
+	parallel=threshold;
+}
+
+unsigned int eBottle::getParallel() const {
+	return parallel;
+}
+
+unsigned int eBottle::pack(const eBottle * b) const {
+	if (b==this) {
+		packed.clear();
+		packedSizes.clear();
+	}
+	unsigned int saved=0;
+	for (unsigned int i=0; i<b->values.size(); i++) {
+		const eValue * v=b->values[i];
+		if (v->getType()==eValue::BOTTLE) {
+			saved+=pack(v->asList());
+			continue;
+		}
+		unsigned int n=payloadSize(v);
+		if (n==0 || n<compression) {
+			continue;
+		}
+		// only worth it if it saves at least a sixteenth
+		unsigned int at=packed.size();
+		unsigned int room=n-n/16;
+		packed.resize(at+room);
+		const char * q=(v->getType()==eValue::STRING) ? v->str()->c_str() : v->asBlob();
+		unsigned int c=eCompress::compress(&packed[at], room, q, n);
+		unsigned int before=pad8(2*sizeof(int)+n);
+		unsigned int after=pad8(3*sizeof(int)+c);
+		if (c==0 || after>=before) {
+			c=0;
+		} else {
+			saved+=before-after;
+		}
+		packed.resize(at+c);
+		packedSizes.push_back(c);
+	}
+	return saved;
+}
+
+unsigned int eBottle::packedSize(const eValue * v, Packing & k) const {
+	if (k.threshold==0) {
+		return 0;
+	}
+	unsigned int n=payloadSize(v);
+	if (n==0 || n<k.threshold) {
+		return 0;
+	}
+	return packedSizes[k.next++];
+}
+
+int eBottle::header(char * p) const {
+	memcpy(p, MAGIC, sizeof(MAGIC));
+	p[4]=VERSION;
+	p[5]=bigEndian ? BIG_ENDIAN_FLAG : 0;
+	p[6]=0;
+	p[7]=0;
+	return HEADER_SIZE;
+}
+
+void eBottle::append(const eBottle & yb) {
+	for (unsigned int i=0; i<yb.count(); i++) {
+		this->add(yb.getPtr(i));
+	}
+}
+
+void eBottle::append(eBottle && yb) {
+	if (&yb==this) {
+		return;
+	}
+	yb.changing();
+	if (arena!=NULL || yb.arena!=NULL) {
+		append(yb);
+		yb.clear();
+		return;
+	}
+	// splice the nodes
+	values.reserve(values.size()+yb.values.size());
+	for (unsigned int i=0; i<yb.values.size(); i++) {
+		adopt(yb.values[i]);
+	}
+	yb.values.clear();
+	yb.clear();
+}
+
+void eBottle::fill(const eBottle * b, int &s, char * p, const bool swap, Packing & k) const {
+	if (pad8(s+sizeof(int))>k.end) {
+		k.overflow=true;
+		return;
+	}
+	putInt(p+s, b->count(), swap);
+	s+=sizeof(int);
+	while (s%8!=0) {
+		p[s++]=0;
+	}
+	fillValues(b, 0, b->count(), s, p, swap, k);
+}
+
+void eBottle::fillValues(const eBottle * b, const unsigned int first, const unsigned int last, int &s, char * p, const bool swap, Packing & k) const {
+	// kept out of k, which the writes to p could alias
+	const unsigned int end=k.end;
+	for (unsigned int i=first; i<last; i++) {
+		const eValue * v=b->values[i];
+		unsigned int c=packedSize(v, k);
+		// the head of a list, which checks the rest
+		const unsigned int need=(c>0) ? pad8(3*sizeof(int)+c) : (v->type==eValue::BOTTLE) ? sizeof(int) : binaryLength(v);
+		if (s+need>end) {
+			k.overflow=true;
+			return;
+		}
+		if (v->type==eValue::INT || v->type==eValue::DOUBLE) {
+			i+=fillRun(b, i, last, s, p, swap, end)-1;
+			continue;
+		}
+		if (c>0) {
+			putInt(p+s, v->getType()|COMPRESSED, swap);
+			putInt(p+s+sizeof(int), c, swap);
+			putInt(p+s+2*sizeof(int), payloadSize(v), swap);
+			s+=3*sizeof(int);
+			memcpy(p+s, &packed[k.at], c);
+			k.at+=c;
+			s+=c;
+			while (s%8!=0) {
+				p[s++]=0;
+			}
+			continue;
+		}
+		putInt(p+s, v->getType(), swap);
+		s+=sizeof(int);
+		switch (v->getType()) {
+			case eValue::CHARP: {
+				putInt(p+s, v->getSize(), swap);
+				s+=sizeof(int);
+				memcpy(p+s, v->asBlob(), v->getSize());
+				s+=v->getSize();
+				break;
+			}
+			case eValue::INT_ARRAY:
+			case eValue::DOUBLE_ARRAY: {
+				putInt(p+s, v->asArrayLength(), swap);
+				s+=sizeof(int);
+				copyArray(p+s, v->asBlob(), v->getType(), v->getSize(), swap);
+				s+=v->getSize();
+				break;
+			}
+			case eValue::BOTTLE: {
+				fill(v->asList(), s, p, swap, k);
+				if (k.overflow) {
+					return;
+				}
+				break;
+			}
+			case eValue::STRING: {
+				int str_len=v->str()->length()+1;
+				putInt(p+s, str_len, swap);
+				s+=sizeof(int);
+				memcpy(p+s, v->str()->c_str(), str_len);
+				s+=str_len;
+				break;
+			}
+			default:
+				break;
+		}
+		while (s%8!=0) {
+			p[s++]=0;
+		}
+	}
+}
+
+/*
+ * A run of ints or doubles is gathered from its nodes into a buffer, 
+ * swapped there if needed, and laid out after its type tags by the 
+ * kernels. It stops before the first value that does not fit in end.
+ */
+unsigned int eBottle::fillRun(const eBottle * b, const unsigned int first, const unsigned int last, int &s, char * p, const bool swap, const unsigned int end) {
+	const unsigned char type=b->values[first]->type;
+	const unsigned int width=(type==eValue::INT) ? 2*sizeof(int) : 2*sizeof(double);
+	unsigned int n=1;
+	while (n<RUN && first+n<last && b->values[first+n]->type==type && s+(n+1)*width<=end) {
+		n++;
+	}
+	char tag[2*sizeof(int)];
+	putInt(tag, type, swap);
+	putInt(tag+sizeof(int), 0, false);
+	if (type==eValue::INT) {
+		int run[RUN];
+		for (unsigned int j=0; j<n; j++) {
+			run[j]=b->values[first+j]->value.i;
+		}
+		if (swap) {
+			eKernels::bswap32(run, run, n);
+		}
+		uint32_t t;
+		memcpy(&t, tag, sizeof(t));
+		eKernels::interleave32(p+s, t, run, n);
+	} else {
+		double run[RUN];
+		for (unsigned int j=0; j<n; j++) {
+			run[j]=b->values[first+j]->value.d;
+		}
+		if (swap) {
+			eKernels::bswap64(run, run, n);
+		}
+		uint64_t t;
+		memcpy(&t, tag, sizeof(t));
+		eKernels::interleave64(p+s, t, run, n);
+	}
+	s+=n*width;
+	return n;
+}
+
+/*
+ * Appends n bytes to the scratch area, handing it to the connection
+ * when full. n is never bigger than the scratch area.
+ */
+static inline void gather(yarp::os::ConnectionWriter& c, char * scratch, int & used, const void * d, const unsigned int n) {
+	if (used+n>eBottle::EXTERNAL_BLOCK) {
+		c.appendBlock(scratch, used);
+		used=0;
+	}
+	memcpy(scratch+used, d, n);
+	used+=n;
+}
+
+static inline void gatherInt(yarp::os::ConnectionWriter& c, char * scratch, int & used, const int v, const bool swap) {
+	char w[sizeof(int)];
+	putInt(w, v, swap);
+	gather(c, scratch, used, w, sizeof(int));
+}
+
+// zeros up to the next multiple of 8 after n bytes of payload
+static inline void gatherPadding(yarp::os::ConnectionWriter& c, char * scratch, int & used, const unsigned int n) {
+	static const char zeros[8]={ 0 };
+	gather(c, scratch, used, zeros, pad8(n)-n);
+}
+
+// sends a payload, big ones straight from where they are
+static inline void gatherPayload(yarp::os::ConnectionWriter& c, char * scratch, int & used, const char * d, const unsigned int n) {
+	if (n<eBottle::EXTERNAL_BLOCK) {
+		gather(c, scratch, used, d, n);
+		return;
+	}
+	if (used>0) {
+		c.appendBlock(scratch, used);
+		used=0;
+	}
+	c.appendExternalBlock(d, n);
+}
+
+// sends array elements in the other byte order, swapping them in the scratch area
+static void gatherSwapped(yarp::os::ConnectionWriter& c, char * scratch, int & used, const char * d, const int type, const unsigned int n) {
+	const unsigned int width=(type==eValue::INT_ARRAY) ? sizeof(int) : sizeof(double);
+	unsigned int done=0;
+	while (done<n) {
+		if (used+width>eBottle::EXTERNAL_BLOCK) {
+			c.appendBlock(scratch, used);
+			used=0;
+		}
+		unsigned int bytes=(eBottle::EXTERNAL_BLOCK-used)/width*width;
+		if (bytes>n-done) {
+			bytes=n-done;
+		}
+		copyArray(scratch+used, d+done, type, bytes, true);
+		used+=bytes;
+		done+=bytes;
+	}
+}
+
+void eBottle::fill(const eBottle * b, ConnectionWriter& c, char * scratch, int & used, const bool swap, Packing & k) const {
+	gatherInt(c, scratch, used, b->count(), swap);
+	if (b==this) {
+		// the top level list starts after the header
+		gatherPadding(c, scratch, used, sizeof(int));
+	}
+	for (unsigned int i=0; i<b->count(); i++) {
+		const eValue * v=b->values[i];
+		unsigned int n=packedSize(v, k);
+		if (n>0) {
+			gatherInt(c, scratch, used, v->getType()|COMPRESSED, swap);
+			gatherInt(c, scratch, used, n, swap);
+			gatherInt(c, scratch, used, payloadSize(v), swap);
+			gatherPayload(c, scratch, used, &packed[k.at], n);
+			gatherPadding(c, scratch, used, sizeof(int)+n);
+			k.at+=n;
+			continue;
+		}
+		if (v->type==eValue::INT || v->type==eValue::DOUBLE) {
+			if (used+RUN*2*sizeof(double)>eBottle::EXTERNAL_BLOCK) {
+				c.appendBlock(scratch, used);
+				used=0;
+			}
+			i+=fillRun(b, i, b->count(), used, scratch, swap, eBottle::EXTERNAL_BLOCK)-1;
+			continue;
+		}
+		gatherInt(c, scratch, used, v->getType(), swap);
+		switch (v->getType()) {
+			case eValue::CHARP:
+				gatherInt(c, scratch, used, v->getSize(), swap);
+				gatherPayload(c, scratch, used, v->asBlob(), v->getSize());
+				gatherPadding(c, scratch, used, v->getSize());
+				break;
+			case eValue::INT_ARRAY:
+			case eValue::DOUBLE_ARRAY:
+				gatherInt(c, scratch, used, v->asArrayLength(), swap);
+				if (swap) {
+					gatherSwapped(c, scratch, used, v->asBlob(), v->getType(), v->getSize());
+				} else {
+					gatherPayload(c, scratch, used, v->asBlob(), v->getSize());
+				}
+				gatherPadding(c, scratch, used, v->getSize());
+				break;
+			case eValue::BOTTLE:
+				fill(v->asList(), c, scratch, used, swap, k);
+				break;
+			case eValue::STRING: {
+				int str_len=v->str()->length()+1;
+				gatherInt(c, scratch, used, str_len, swap);
+				gatherPayload(c, scratch, used, v->str()->c_str(), str_len);
+				gatherPadding(c, scratch, used, str_len);
+				break;
+			}
+			default:
+				gatherPadding(c, scratch, used, sizeof(int));
+				break;
+		}
+	}
+}
+
+/*
+ * Parallel coding
+ * 
+ * The pool runs the parts of one message at a time on its threads and on 
+ * the thread that asks for it, which returns once they are all done. A 
+ * message asked for while another one is being coded is coded by its own 
+ * thread alone. The threads are started the first time they are needed.
+ */
+class WorkerPool {
+	public:
+		typedef std::function<void(unsigned int)> Task;
+
+		static WorkerPool & get() {
+			static WorkerPool pool;
+			return pool;
+		}
+
+		~WorkerPool() {
+			stop();
+		}
+
+		unsigned int threads() const {
+			return size;
+		}
+
+		void resize(const unsigned int n) {
+			std::lock_guard<std::mutex> one(running);
+			stop();
+			size=(n>0) ? n : processors();
+		}
+
+		// runs task(i) for every i below n
+		void run(const unsigned int n, const Task & t) {
+			std::unique_lock<std::mutex> one(running, std::try_to_lock);
+			if (n<2 || size<2 || !one.owns_lock()) {
+				for (unsigned int i=0; i<n; i++) {
+					t(i);
+				}
+				return;
+			}
+			std::unique_lock<std::mutex> lock(m);
+			while (workers.size()+1<size) {
+				// started before this message, so they take part in it
+				workers.push_back(std::thread(&WorkerPool::work, this, generation));
+			}
+			task=&t;
+			count=n;
+			next=0;
+			finished=0;
+			generation++;
+			lock.unlock();
+			wake.notify_all();
+			share(t, n);
+			lock.lock();
+			idle.wait(lock, [this]() { return finished==count && busy==0; });
+			task=NULL;
+		}
+
+	private:
+		WorkerPool() : size(processors()), task(NULL), count(0), next(0), finished(0), busy(0), generation(0), stopping(false) {}
+
+		static unsigned int processors() {
+			const unsigned int n=std::thread::hardware_concurrency();
+			return (n>0) ? n : 1;
+		}
+
+		// takes parts until there are none left
+		void share(const Task & t, const unsigned int n) {
+			unsigned int done=0;
+			for (unsigned int i=next++; i<n; i=next++) {
+				t(i);
+				done++;
+			}
+			std::lock_guard<std::mutex> lock(m);
+			finished+=done;
+			if (finished==count && busy==0) {
+				idle.notify_all();
+			}
+		}
+
+		void work(unsigned long seen) {
+			std::unique_lock<std::mutex> lock(m);
+			while (true) {
+				wake.wait(lock, [&]() { return stopping || generation!=seen; });
+				if (stopping) {
+					return;
+				}
+				seen=generation;
+				if (task==NULL) {
+					// woken after the message was done
+					continue;
+				}
+				const Task * t=task;
+				const unsigned int n=count;
+				busy++;
+				lock.unlock();
+				share(*t, n);
+				lock.lock();
+				busy--;
+				if (finished==count && busy==0) {
+					idle.notify_all();
+				}
+			}
+		}
+
+		void stop() {
+			{
+				std::lock_guard<std::mutex> lock(m);
+				stopping=true;
+			}
+			wake.notify_all();
+			for (unsigned int i=0; i<workers.size(); i++) {
+				workers[i].join();
+			}
+			workers.clear();
+			stopping=false;
+		}
+
+		unsigned int size;
+		std::vector<std::thread> workers;
+		// one message at a time
+		std::mutex running;
+		std::mutex m;
+		std::condition_variable wake;
+		std::condition_variable idle;
+		const Task * task;
+		unsigned int count;
+		std::atomic<unsigned int> next;
+		unsigned int finished;
+		unsigned int busy;
+		unsigned long generation;
+		bool stopping;
+};
+
+void eBottle::setThreads(const unsigned int n) {
+	WorkerPool::get().resize(n);
+}
+
+unsigned int eBottle::getThreads() {
+	return WorkerPool::get().threads();
+}
+
+bool eBottle::isParallel(const unsigned int size) const {
+	// arena eBottles use one thread, as the parts build their nodes on the heap
+	return parallel>0 && size>=parallel && arena==NULL && WorkerPool::get().threads()>1;
+}
+
+// values first to last of the list b, written from the offset at to end
+struct eBottle::Part {
+	Part(const eBottle * l, const unsigned int f, const unsigned int e, const int a, const int z) : b(l), first(f), last(e), at(a), end(z) {}
+	const eBottle * b;
+	unsigned int first;
+	unsigned int last;
+	int at;
+	int end;
+};
+
+/*
+ * Splits the list b, whose binary representation starts at s, in parts 
+ * of about grain bytes. The heads of the lists split further are written 
+ * here, and s is moved to the end of the list.
+ */
+void eBottle::plan(const eBottle * b, int & s, char * p, const bool swap, const unsigned int grain, std::vector<Part> & parts, Packing & k) const {
+	if (pad8(s+sizeof(int))>k.end) {
+		k.overflow=true;
+		return;
+	}
+	putInt(p+s, b->count(), swap);
+	s+=sizeof(int);
+	while (s%8!=0) {
+		p[s++]=0;
+	}
+	unsigned int first=0;
+	int at=s;
+	for (unsigned int i=0; i<b->count(); i++) {
+		const eValue * v=b->values[i];
+		const unsigned int n=binaryLength(v);
+		if (v->type==eValue::BOTTLE && n>grain) {
+			if (first<i) {
+				parts.push_back(Part(b, first, i, at, s));
+			}
+			if (s+sizeof(int)>k.end) {
+				k.overflow=true;
+				return;
+			}
+			putInt(p+s, eValue::BOTTLE, swap);
+			s+=sizeof(int);
+			plan(v->asList(), s, p, swap, grain, parts, k);
+			if (k.overflow) {
+				return;
+			}
+			first=i+1;
+			at=s;
+			continue;
+		}
+		s+=n;
+		if ((unsigned int) (s-at)>=grain) {
+			parts.push_back(Part(b, first, i+1, at, s));
+			first=i+1;
+			at=s;
+		}
+	}
+	if (first<b->count()) {
+		parts.push_back(Part(b, first, b->count(), at, s));
+	}
+}
+
+// writes the top level list after the header, false if it is not worth
+// doing it in parallel. Each part must end where the cached sizes say.
+bool eBottle::fillParallel(int & s, char * p, const bool swap, Packing & k) const {
+	const unsigned int size=getBinarySize();
+	if (compression>0 || !isParallel(size)) {
+		return false;
+	}
+	WorkerPool & pool=WorkerPool::get();
+	// a few parts per thread, so that they all end at about the same time
+	const unsigned int grain=std::max(size/(4*pool.threads()), (unsigned int) STREAM_CHUNK);
+	std::vector<Part> parts;
+	plan(this, s, p, swap, grain, parts, k);
+	if (k.overflow || (unsigned int) s>k.end) {
+		k.overflow=true;
+		return true;
+	}
+	std::atomic<bool> wrong(false);
+	pool.run(parts.size(), [&](const unsigned int j) {
+		Packing q(0, parts[j].end);
+		int at=parts[j].at;
+		fillValues(parts[j].b, parts[j].first, parts[j].last, at, p, swap, q);
+		if (q.overflow || at!=parts[j].end) {
+			wrong=true;
+		}
+	});
+	k.overflow=wrong;
+	return true;
+}
+
+/*
+ * Decodes the top level values of a valid message, at the given offsets, 
+ * in parallel. They are appended or, with reuse, replace the values there 
+ * reusing their eValues as update() does. Each part builds its new 
+ * eValues in an eBottle of its own and moves them to their places, so 
+ * nothing is shared between parts but the message. The lists have no 
+ * parent until all parts are done, so that their changes do not reach 
+ * this eBottle from several threads.
+ */
+void eBottle::decodeParallel(const char * p, const int size, const std::vector<int> & offsets, const bool reuse) {
+	const unsigned int n=offsets.size();
+	// the sizes are computed again when needed, so growing nested lists 
+	// stop at this one
+	touch();
+	unsigned int base=values.size();
+	if (reuse) {
+		while (values.size()>n) {
+			freeValue(values.back());
+			values.pop_back();
+		}
+		base=0;
+	}
+	values.resize(base+n, NULL);
+	WorkerPool & pool=WorkerPool::get();
+	const unsigned int parts=std::min(n, 4*pool.threads());
+	pool.run(parts, [&](const unsigned int j) {
+		eBottle scratch;
+		Cursor c(p, size);
+		for (unsigned int i=(unsigned long long) n*j/parts; i<(unsigned long long) n*(j+1)/parts; i++) {
+			eValue *& v=values[base+i];
+			c.s=offsets[i];
+			if (v!=NULL) {
+				if (v->type==eValue::BOTTLE && !v->isShared() && c.getInt()==eValue::BOTTLE) {
+					v->value.list.ptr->parent=NULL;
+					update(v->value.list.ptr, c);
+					continue;
+				}
+				c.s=offsets[i];
+				if (overwrite(v, c)) {
+					continue;
+				}
+				c.s=offsets[i];
+				freeValue(v);
+			}
+			reconstructValue(&scratch, c);
+			v=scratch.values.back();
+			scratch.values.pop_back();
+			v->owner=this;
+			if (v->type==eValue::BOTTLE) {
+				v->value.list.ptr->parent=NULL;
+			}
+		}
+	});
+	for (unsigned int i=base; i<values.size(); i++) {
+		if (values[i]->type==eValue::BOTTLE) {
+			values[i]->value.list.ptr->parent=this;
+		}
+	}
+	changing();
+}
+
+void eBottle::reconstruct(eBottle * b, Cursor & c) const {
+	unsigned int n_elem_bottle = c.getInt();
+	c.align();
+	b->values.reserve(b->values.size()+n_elem_bottle);
+	for (unsigned int i=0; i<n_elem_bottle; ) {
+		unsigned int n=reconstructRun(b, c, n_elem_bottle-i);
+		if (n==0) {
+			reconstructValue(b, c);
+			n=1;
+		}
+		i+=n;
+	}
+}
+
+/*
+ * Decodes the run of ints or doubles at the cursor, up to left values, 
+ * taking their payloads out with the kernels. It gives 0, and decodes 
+ * nothing, if the next two values are not a run. Doubles are only taken 
+ * this way in the padded layout.
+ */
+unsigned int eBottle::reconstructRun(eBottle * b, Cursor & c, const unsigned int left) {
+	const int type=::getInt(c.p+c.s, c.swap);
+	if (type!=eValue::INT && !(type==eValue::DOUBLE && c.aligned)) {
+		return 0;
+	}
+	const unsigned int width=(type==eValue::INT) ? 2*sizeof(int) : 2*sizeof(double);
+	unsigned int n=1;
+	while (n<RUN && n<left && ::getInt(c.p+c.s+n*width, c.swap)==type) {
+		n++;
+	}
+	if (n<2) {
+		return 0;
+	}
+	b->changing();
+	if (type==eValue::INT) {
+		int run[RUN];
+		eKernels::deinterleave32(run, c.p+c.s, n);
+		if (c.swap) {
+			eKernels::bswap32(run, run, n);
+		}
+		for (unsigned int j=0; j<n; j++) {
+			b->values.push_back(new (b->allocValue()) eValue(run[j]));
+		}
+	} else {
+		double run[RUN];
+		eKernels::deinterleave64(run, c.p+c.s, n);
+		if (c.swap) {
+			eKernels::bswap64(run, run, n);
+		}
+		for (unsigned int j=0; j<n; j++) {
+			b->values.push_back(new (b->allocValue()) eValue(run[j]));
+		}
+	}
+	c.s+=n*width;
+	b->grow(n*width);
+	return n;
+}
+
+void eBottle::reconstructValue(eBottle * b, Cursor & c) const {
+	int type = c.getInt();
+	switch (type) {
+		case eValue::INT: {
+			b->addInt(c.getInt());
+			break;
+		}
+		case eValue::DOUBLE: {
+			b->addDouble(c.getDouble());
+			break;
+		}
+		case eValue::CHARP: {
+			int dim=c.getInt();
+			b->addBlob(c.p+c.s, dim);
+			c.s+=dim;
+			break;
+		}
+		case eValue::INT_ARRAY:
+		case eValue::DOUBLE_ARRAY: {
+			unsigned int dim=c.getInt()*eValue::elementSize(type);
+			eValue * v=b->addBlock(type, NULL, dim);
+			c.getArray(v->value.blob.data, type, dim);
+			break;
+		}
+		case eValue::BOTTLE: {
+			eBottle * q=b->newList();
+			reconstruct(q, c);
+			break;
+		}
+		case eValue::STRING: {
+			int strlen=c.getInt();
+			b->addString(c.p+c.s);
+			c.s+=strlen;
+			break;
+		}
+		case eValue::CHARP|COMPRESSED: {
+			int n=c.getInt();
+			int dim=c.getInt();
+			eValue * v=b->addBlock(eValue::CHARP, NULL, dim);
+			eCompress::decompress(v->value.blob.data, dim, c.p+c.s, n);
+			c.s+=n;
+			c.packed=true;
+			break;
+		}
+		case eValue::STRING|COMPRESSED: {
+			int n=c.getInt();
+			std::string t(c.getInt(), '\0');
+			eCompress::decompress(&t[0], t.length(), c.p+c.s, n);
+			// up to the null character, as for the strings sent as they are
+			t.resize(strlen(t.c_str()));
+			b->addString(std::move(t));
+			c.s+=n;
+			c.packed=true;
+			break;
+		}
+		default:
+			b->add(eValue());
+			break;
+	}
+	c.align();
+}
+
+bool eBottle::overwrite(eValue * v, Cursor & c) {
+	if (v==NULL || v->isShared()) {
+		return false;
+	}
+	int type=c.getInt();
+	if (type==(eValue::CHARP|COMPRESSED) && v->type==eValue::CHARP) {
+		int n=c.getInt();
+		if ((unsigned int) c.getInt()!=v->size) {
+			return false;
+		}
+		eCompress::decompress(v->value.blob.data, v->size, c.p+c.s, n);
+		c.s+=n;
+		c.packed=true;
+		c.align();
+		return true;
+	}
+	if (type!=v->type) {
+		return false;
+	}
+	switch (v->type) {
+		case eValue::INT:
+			v->value.i = c.getInt();
+			break;
+		case eValue::DOUBLE:
+			v->value.d = c.getDouble();
+			break;
+		case eValue::CHARP:
+		case eValue::INT_ARRAY:
+		case eValue::DOUBLE_ARRAY: {
+			unsigned int dim=c.getInt()*eValue::elementSize(v->type);
+			if (dim!=v->size) {
+				// a blob of a different size needs a new node
+				return false;
+			}
+			c.getArray(v->value.blob.data, v->type, dim);
+			break;
+		}
+		case eValue::BOTTLE:
+			return false;
+		case eValue::STRING: {
+			int strlen=c.getInt();
+			v->str()->assign(c.p+c.s);
+			c.s+=strlen;
+			break;
+		}
+	}
+	c.align();
+	return true;
+}
+
+// moves the value just added to b to the position i, freeing the one there
+void eBottle::replace(eBottle * b, const unsigned int i) {
+	eValue * v=(i<b->values.size()-1) ? b->values[i] : NULL;
+	if (v!=NULL) {
+		b->values[i]=b->values.back();
+		b->values.pop_back();
+		b->freeValue(v);
+	}
+}
+
+void eBottle::update(eBottle * b, Cursor & c) const {
+	unsigned int n_elem_bottle = c.getInt();
+	c.align();
+	int start=c.s;
+	for (unsigned int i=0; i<n_elem_bottle; i++) {
+		eValue * v = (i<b->values.size()) ? b->values[i] : NULL;
+		int at=c.s;
+		if (v!=NULL && v->type==eValue::BOTTLE && !v->isShared() && c.getInt()==eValue::BOTTLE) {
+			v->value.list.ptr->parent=b;
+			update(v->value.list.ptr, c);
+			continue;
+		}
+		c.s=at;
+		if (!overwrite(v, c)) {
+			c.s=at;
+			reconstructValue(b, c);
+			replace(b, i);
+		}
+	}
+	while (b->values.size()>n_elem_bottle) {
+		b->freeValue(b->values.back());
+		b->values.pop_back();
+	}
+	b->global_size=c.s-start+EMPTY_SIZE;
+	// compressed payloads take less on the wire than they will
+	b->dirty=c.packed;
+	b->indexed=0;
+}
+
+/*
+ * Incremental decoding
+ * 
+ * The stack holds the lists being filled, the message first. A value is 
+ * decoded once all of its bytes are there; a nested list is added as soon 
+ * as its amount of values is, and filled by the following values. Every 
+ * step either moves forward or waits for more bytes, so each byte is 
+ * looked at a bounded amount of times however the message is split.
+ */
+eBottleDecoder::eBottleDecoder(eBottle & t) : target(t), buffer(NULL), sliding(false), base(0), size(0), received(0), pos(0), done(0), swap(false), packed(false), state(FAILED) {
+}
+
+void eBottleDecoder::begin(const int s, char * b) {
+	target.changing();
+	stack.clear();
+	size=s;
+	received=0;
+	base=0;
+	pos=0;
+	done=0;
+	swap=false;
+	packed=false;
+	state=(s<(int) sizeof(int)) ? FAILED : MORE;
+	sliding=(b==NULL);
+	own.clear();
+	buffer=b;
+}
+
+/*
+ * Makes room for n more bytes. The buffer of the decoder only keeps the 
+ * bytes from the next value on: the ones before it are dropped once the 
+ * header is decoded, as the legacy layout is decoded as a whole.
+ */
+void eBottleDecoder::reserve(const int n) {
+	if (!sliding) {
+		return;
+	}
+	if (pos>base) {
+		memmove(own.data(), own.data()+(pos-base), received-pos);
+		base=pos;
+	}
+	if ((size_t) (received-base+n)>own.size()) {
+		own.resize(received-base+n);
+	}
+	buffer=own.data();
+}
+
+eBottleDecoder::Status eBottleDecoder::feed(const char * p, const int n) {
+	if (state!=MORE) {
+		return state;
+	}
+	if (n<0 || n>size-received) {
+		return fail();
+	}
+	reserve(n);
+	memcpy(buffer+(received-base), p, n);
+	received+=n;
+	return decode();
+}
+
+eBottleDecoder::Status eBottleDecoder::receive(ConnectionReader& connection, const int n) {
+	if (state!=MORE) {
+		return state;
+	}
+	if (n<0 || n>size-received) {
+		return fail();
+	}
+	reserve(n);
+	connection.expectBlock(buffer+(received-base), n);
+	if (connection.isError()) {
+		return fail();
+	}
+	received+=n;
+	return decode();
+}
+
+eBottleDecoder::Status eBottleDecoder::status() const {
+	return state;
+}
+
+unsigned int eBottleDecoder::decoded() const {
+	return done;
+}
+
+int eBottleDecoder::remaining() const {
+	return size-received;
+}
+
+eBottleDecoder::Status eBottleDecoder::fail() {
+	target.clear();
+	stack.clear();
+	done=0;
+	state=FAILED;
+	return state;
+}
+
+eBottleDecoder::Status eBottleDecoder::decode() {
+	if (pos==0) {
+		if (received<(int) EMPTY_SIZE && received<size) {
+			return state;
+		}
+		eBottle::Cursor c(buffer, received);
+		if (!c.aligned) {
+			// the legacy layout can only be checked as a whole
+			if (received<size) {
+				return state;
+			}
+			if (!eBottle::validate(buffer, size, NULL)) {
+				return fail();
+			}
+			target.clear();
+			target.reconstruct(&target, c);
+			done=target.size();
+			state=DONE;
+			return state;
+		}
+		if ((buffer[5] & ~BIG_ENDIAN_FLAG)!=0) {
+			return fail();
+		}
+		int n=c.getInt();
+		c.align();
+		if (n<0 || n>(size-c.s)/(int) (2*sizeof(int))) {
+			return fail();
+		}
+		swap=c.swap;
+		open(&target, n, c.s);
+		pos=c.s;
+	}
+	// positions in the buffer are relative to base from here on
+	eBottle::Cursor c(buffer, 0);
+	c.aligned=true;
+	c.swap=swap;
+	while (!stack.empty()) {
+		Frame & f=stack.back();
+		if (f.i==f.n) {
+			close(f);
+			stack.pop_back();
+			if (stack.size()==1) {
+				done++;
+			}
+			continue;
+		}
+		// every value starts with 8 bytes: the type and the size or padding
+		if (received-pos<(int) (2*sizeof(int))) {
+			return (received==size) ? fail() : state;
+		}
+		eBottle * b=f.list;
+		eValue * v=(f.i<b->values.size()) ? b->values[f.i] : NULL;
+		c.s=pos-base;
+		if (c.getInt()==eValue::BOTTLE) {
+			int n=c.getInt();
+			if ((int) stack.size()>eBottle::MAX_DEPTH || n<0 || n>(size-base-c.s)/(int) (2*sizeof(int))) {
+				return fail();
+			}
+			eBottle * list;
+			if (v!=NULL && v->getType()==eValue::BOTTLE && !v->isShared()) {
+				// not shared, so filled in place
+				list=v->value.list.ptr;
+				list->parent=b;
+			} else {
+				list=b->newList();
+				eBottle::replace(b, f.i);
+			}
+			f.i++;
+			// f is not valid after this
+			open(list, n, base+c.s);
+			pos=base+c.s;
+			continue;
+		}
+		c.s=pos-base;
+		if (!c.skipValue(received-base, stack.size()-1)) {
+			return (received==size) ? fail() : state;
+		}
+		c.s=pos-base;
+		if (!eBottle::overwrite(v, c)) {
+			c.s=pos-base;
+			target.reconstructValue(b, c);
+			eBottle::replace(b, f.i);
+		}
+		packed=packed || c.packed;
+		pos=base+c.s;
+		f.i++;
+		if (stack.size()==1) {
+			done++;
+		}
+	}
+	if (pos!=size) {
+		return fail();
+	}
+	state=DONE;
+	return state;
+}
+
+void eBottleDecoder::open(eBottle * list, const unsigned int n, const int start) {
+	list->values.reserve(n);
+	Frame f={ list, n, 0, start };
+	stack.push_back(f);
+}
+
+// drops the values left from the previous contents, as eBottle::update
+void eBottleDecoder::close(const Frame & f) {
+	eBottle * b=f.list;
+	while (b->values.size()>f.n) {
+		b->freeValue(b->values.back());
+		b->values.pop_back();
+	}
+	b->global_size=pos-f.start+EMPTY_SIZE;
+	b->dirty=packed;
+	b->indexed=0;
+}
+
+/*
+ * Delta streams
+ * 
+ * Every message starts with a header like the one of eBottle, with the 
+ * DELTA flag, followed by a sequence number and a hash of the shape. A 
+ * keyframe (KEYFRAME flag) then holds the whole eBottle, header included. 
+ * Otherwise come the amount of values with a payload, 4 zero bytes, a 
+ * bitmap of the ones that changed padded to 8 bytes, and their payloads, 
+ * each one padded to 8 bytes. The shape is the sequence of types, in 
+ * pre-order, with the payload size of each value and the amount of values 
+ * of each list.
+ */
+static const unsigned int DELTA_HEADER_SIZE=16;
+
+static uint32_t shapeHash(const std::vector<unsigned int> & shape) {
+	uint32_t h=FNV_BASIS;
+	for (unsigned int i=0; i<shape.size(); i++) {
+		h=fnvStep(h, shape[i]);
+	}
+	return h;
+}
+
+void eBottle::flatten(eBottle * b, std::vector<eValue *> & leaves, std::vector<unsigned int> & shape) {
+	for (unsigned int i=0; i<b->values.size(); i++) {
+		eValue * v=b->values[i];
+		shape.push_back(v->type);
+		if (v->type==eValue::BOTTLE) {
+			shape.push_back(v->value.list.ptr->values.size());
+			flatten(v->value.list.ptr, leaves, shape);
+		} else {
+			unsigned int n;
+			leafData(v, n);
+			shape.push_back(n);
+			if (v->type!=eValue::EMPTY) {
+				// handed out, as they may be patched
+				v->owner=b;
+				leaves.push_back(v);
+			}
+		}
+	}
+}
+
+// gives b its own copy of the lists it shares, at every level, which 
+// copies do not share from then on, as their values are written in place
+void eBottle::own(eBottle * b) {
+	for (unsigned int i=0; i<b->values.size(); i++) {
+		eValue * v=b->values[i];
+		if (v->type==eValue::BOTTLE) {
+			v->detach();
+			v->value.list.ptr->parent=b;
+			v->value.list.ptr->expose();
+			own(v->value.list.ptr);
+		}
+	}
+}
+
+char * eBottle::leafData(eValue * v, unsigned int & bytes) {
+	switch (v->type) {
+		case eValue::INT:
+			bytes=sizeof(int);
+			return (char *) &v->value.i;
+		case eValue::DOUBLE:
+			bytes=sizeof(double);
+			return (char *) &v->value.d;
+		case eValue::CHARP:
+		case eValue::INT_ARRAY:
+		case eValue::DOUBLE_ARRAY:
+			bytes=v->size;
+			return v->value.blob.data;
+		case eValue::STRING:
+			bytes=v->str()->length();
+			return &(*v->str())[0];
+		default:
+			bytes=0;
+			return NULL;
+	}
+}
+
+void eBottle::patch(eValue * v, const char * p, const bool swap) {
+	// a change of the target, for its key indexes
+	v->changing();
+	switch (v->type) {
+		case eValue::INT:
+			v->value.i=getInt(p, swap);
+			break;
+		case eValue::DOUBLE:
+			v->value.d=getDouble(p, swap);
+			break;
+		case eValue::CHARP:
+		case eValue::INT_ARRAY:
+		case eValue::DOUBLE_ARRAY:
+			v->detach();
+			copyArray(v->value.blob.data, p, v->type, v->size, swap);
+			break;
+		case eValue::STRING:
+			if (v->isShared()) {
+				*v=eValue(std::string(p, v->str()->length()));
+			} else {
+				memcpy(&(*v->str())[0], p, v->str()->length());
+			}
+			break;
+	}
+}
+
+// writes the payload of a value in wire byte order
+static void putPayload(char * d, const eValue * v, const char * data, const unsigned int n, const bool swap) {
+	switch (v->getType()) {
+		case eValue::INT:
+			putInt(d, v->asInt(), swap);
+			break;
+		case eValue::DOUBLE:
+			putDouble(d, v->asDouble(), swap);
+			break;
+		case eValue::STRING:
+			memcpy(d, data, n);
+			break;
+		default:
+			copyArray(d, data, v->getType(), n, swap);
+			break;
+	}
+}
+
+/*
+ * A delta is made in one walk of the eBottle, which checks it against the 
+ * shape of the last keyframe and compares each payload with the one last 
+ * sent, appending the ones that changed to the message.
+ */
+struct eBottle::Delta {
+	const unsigned int * shape;
+	const unsigned int * end;
+	char * image;
+	std::vector<char> * message;
+	// bitmap position in the message
+	unsigned int bits;
+	unsigned int leaf;
+	bool swap;
+};
+
+// false if the shape changed
+bool eBottle::diff(const eBottle * b, Delta & d) {
+	for (unsigned int i=0; i<b->values.size(); i++) {
+		eValue * v=b->values[i];
+		if (d.end-d.shape<2 || *d.shape++!=(unsigned int) v->type) {
+			return false;
+		}
+		if (v->type==eValue::BOTTLE) {
+			if (*d.shape++!=v->value.list.ptr->values.size() || !diff(v->value.list.ptr, d)) {
+				return false;
+			}
+			continue;
+		}
+		unsigned int n;
+		const char * data=leafData(v, n);
+		if (*d.shape++!=n) {
+			return false;
+		}
+		if (v->type==eValue::EMPTY) {
+			continue;
+		}
+		bool changed;
+		if (v->type==eValue::INT) {
+			changed=memcmp(data, d.image, sizeof(int))!=0;
+		} else if (v->type==eValue::DOUBLE) {
+			changed=memcmp(data, d.image, sizeof(double))!=0;
+		} else {
+			changed=n>0 && memcmp(data, d.image, n)!=0;
+		}
+		if (changed) {
+			memcpy(d.image, data, n);
+			std::vector<char> & m=*d.message;
+			m[d.bits+d.leaf/8]|=(char) (1<<(d.leaf%8));
+			unsigned int at=m.size();
+			m.resize(at+pad8(n), 0);
+			putPayload(&m[at], v, data, n, d.swap);
+		}
+		d.image+=n;
+		d.leaf++;
+	}
+	return true;
+}
+
+eBottleDeltaWriter::eBottleDeltaWriter(eBottle & s, const unsigned int k) : source(s), keyframes(k), sinceKeyframe(0), sequence(0), keyframe(false), forceKeyframe(true), hash(0) {
+}
+
+void eBottleDeltaWriter::requestKeyframe() {
+	forceKeyframe=true;
+}
+
+bool eBottleDeltaWriter::wasKeyframe() const {
+	return keyframe;
+}
+
+bool eBottleDeltaWriter::write(ConnectionWriter& connection) {
+	const bool swap=source.isBigEndian()!=hostBigEndian();
+	const unsigned int first=DELTA_HEADER_SIZE+2*sizeof(int);
+	keyframe=forceKeyframe || (keyframes>0 && sinceKeyframe>=keyframes);
+	if (!keyframe) {
+		message.assign(first+pad8((leaves.size()+7)/8), 0);
+		eBottle::Delta d;
+		d.shape=shape.data();
+		d.end=d.shape+shape.size();
+		d.image=image.data();
+		d.message=&message;
+		d.bits=first;
+		d.leaf=0;
+		d.swap=swap;
+		keyframe=!eBottle::diff(&source, d) || d.shape!=d.end;
+	}
+	if (keyframe) {
+		shape.clear();
+		leaves.clear();
+		eBottle::flatten(&source, leaves, shape);
+		hash=shapeHash(shape);
+	}
+	sequence++;
+	char h[DELTA_HEADER_SIZE];
+	source.header(h);
+	h[5]|=DELTA_FLAG | (keyframe ? KEYFRAME_FLAG : 0);
+	putInt(h+HEADER_SIZE, sequence, swap);
+	putInt(h+HEADER_SIZE+sizeof(int), hash, swap);
+	if (keyframe) {
+		// the payloads the next messages are compared with
+		image.clear();
+		for (unsigned int i=0; i<leaves.size(); i++) {
+			unsigned int n;
+			const char * data=eBottle::leafData(leaves[i], n);
+			image.insert(image.end(), data, data+n);
+		}
+		int n;
+		const char * body=source.toBinary(&n);
+		connection.appendInt(DELTA_HEADER_SIZE+n);
+		connection.appendBlock(h, DELTA_HEADER_SIZE);
+		connection.appendExternalBlock(body, n);
+		forceKeyframe=false;
+		sinceKeyframe=1;
+		return true;
+	}
+	memcpy(&message[0], h, DELTA_HEADER_SIZE);
+	putInt(&message[DELTA_HEADER_SIZE], leaves.size(), swap);
+	connection.appendInt(message.size());
+	connection.appendBlock(&message[0], message.size());
+	sinceKeyframe++;
+	return true;
+}
+
+eBottleDeltaReader::eBottleDeltaReader(eBottle & t) : target(t), synchronized(false), sequence(0), hash(0), revision(0) {
+}
+
+bool eBottleDeltaReader::isSynchronized() const {
+	return synchronized;
+}
+
+bool eBottleDeltaReader::read(ConnectionReader& connection) {
+	int size=connection.expectInt();
+	if (size<(int) (DELTA_HEADER_SIZE+2*sizeof(int))) {
+		return false;
+	}
+	buffer.resize(size);
+	connection.expectBlock(&buffer[0], size);
+	const char * p=&buffer[0];
+	if (connection.isError() || memcmp(p, MAGIC, sizeof(MAGIC))!=0 || (unsigned char) p[4]!=VERSION || (p[5] & DELTA_FLAG)==0) {
+		return false;
+	}
+	const bool swap=((p[5] & BIG_ENDIAN_FLAG)!=0)!=hostBigEndian();
+	uint32_t s=getInt(p+HEADER_SIZE, swap);
+	uint32_t h=getInt(p+HEADER_SIZE+sizeof(int), swap);
+	if ((p[5] & KEYFRAME_FLAG)!=0) {
+		const char * body=p+DELTA_HEADER_SIZE;
+		int n=size-DELTA_HEADER_SIZE;
+		eBottle::Cursor c(body, n);
+		if (!c.aligned || !eBottle::validate(body, n, NULL)) {
+			return false;
+		}
+		// written in place from here on
+		target.changing();
+		target.update(&target, c);
+		if (target.parent!=NULL) {
+			target.parent->touch();
+		}
+		eBottle::own(&target);
+		shape.clear();
+		leaves.clear();
+		eBottle::flatten(&target, leaves, shape);
+		revision=target.revision;
+		sequence=s;
+		hash=h;
+		synchronized=(shapeHash(shape)==h);
+		return synchronized;
+	}
+	if (!synchronized || s!=sequence+1 || h!=hash || !apply(p, size, swap)) {
+		// something was missed, wait for a keyframe
+		synchronized=false;
+		return false;
+	}
+	sequence=s;
+	return true;
+}
+
+bool eBottleDeltaReader::apply(const char * p, const int size, const bool swap) {
+	if (target.revision!=revision) {
+		// the target was changed since the last message, so the leaves 
+		// are found again, in lists of its own
+		eBottle::own(&target);
+		leaves.clear();
+		current.clear();
+		eBottle::flatten(&target, leaves, current);
+		revision=target.revision;
+		if (current!=shape) {
+			return false;
+		}
+	}
+	const unsigned int count=getInt(p+DELTA_HEADER_SIZE, swap);
+	if (count!=leaves.size()) {
+		return false;
+	}
+	const unsigned char * bits=(const unsigned char *) p+DELTA_HEADER_SIZE+2*sizeof(int);
+	const unsigned int first=DELTA_HEADER_SIZE+2*sizeof(int)+pad8((count+7)/8);
+	if (first>(unsigned int) size) {
+		return false;
+	}
+	// the size is checked first, so that invalid messages change nothing
+	unsigned long long end=first;
+	for (unsigned int i=0; i<count; i+=8) {
+		unsigned char byte=bits[i/8];
+		for (unsigned int j=i; byte!=0 && j<count; j++, byte>>=1) {
+			if ((byte & 1)!=0) {
+				unsigned int n;
+				eBottle::leafData(leaves[j], n);
+				end+=pad8(n);
+			}
+		}
+	}
+	if (end!=(unsigned int) size) {
+		return false;
+	}
+	unsigned int at=first;
+	bool keys=false;
+	for (unsigned int i=0; i<count; i+=8) {
+		unsigned char byte=bits[i/8];
+		for (unsigned int j=i; byte!=0 && j<count; j++, byte>>=1) {
+			if ((byte & 1)!=0) {
+				unsigned int n;
+				eBottle::leafData(leaves[j], n);
+				eBottle::patch(leaves[j], p+at, swap);
+				at+=pad8(n);
+				keys|=leaves[j]->getType()==eValue::STRING;
+			}
+		}
+	}
+	// strings are patched in place, under any key index
+	if (keys) {
+		target.dropIndexes();
+	}
+	revision=target.revision;
+	return true;
+}
+
+/*
+ * Text output
+ * 
+ * The text is gathered in a fixed chunk which is appended to the target 
+ * string or written to the file whenever it fills up, so rendering does 
+ * not allocate beyond the growth of the target itself.
+ */
+struct eBottle::TextWriter {
+	TextWriter(std::string * target) : s(target), f(NULL), used(0), ok(true) {}
+	TextWriter(FILE * file) : s(NULL), f(file), used(0), ok(true) {}
+	~TextWriter() {
+		flush();
+	}
+	void put(const char c) {
+		if (used==sizeof(chunk)) {
+			flush();
+		}
+		chunk[used++]=c;
+	}
+	void put(const char * p, unsigned int n) {
+		if (used+n>sizeof(chunk)) {
+			flush();
+			if (n>sizeof(chunk)) {
+				write(p, n);
+				return;
+			}
+		}
+		memcpy(chunk+used, p, n);
+		used+=n;
+	}
+	void putInt(const int v) {
+		char tmp[16];
+		char * q=tmp+sizeof(tmp);
+		unsigned int u=(v<0) ? 0u-(unsigned int) v : (unsigned int) v;
+		do {
+			*--q=(char) ('0'+u%10);
+			u/=10;
+		} while (u!=0);
+		if (v<0) {
+			*--q='-';
+		}
+		put(q, tmp+sizeof(tmp)-q);
+	}
+	void putDouble(const double d) {
+		char tmp[32];
+		put(tmp, formatDouble(d, tmp));
+	}
+	void putString(const std::string & t);
+	void flush() {
+		write(chunk, used);
+		used=0;
+	}
+	void write(const char * p, unsigned int n) {
+		if (n==0) {
+			return;
+		}
+		if (s!=NULL) {
+			s->append(p, n);
+		} else if (ok) {
+			ok=(fwrite(p, 1, n, f)==n);
+		}
+	}
+	// shortest form that reads back to the same double, always with a '.'
+	// or an exponent so that it does not read back as an integer, and with 
+	// a sign for inf and nan, which are words otherwise
+	static unsigned int formatDouble(const double d, char * p) {
+		if (d!=d) {
+			memcpy(p, "+nan", 4);
+			return 4;
+		}
+		if (d-d!=0) {
+			memcpy(p, (d<0) ? "-inf" : "+inf", 4);
+			return 4;
+		}
+		// most values have few decimals: find the fewest that give d back,
+		// m/10^k with both exact is rounded like the parse of its digits
+		static const double POW10[]={1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+		for (int k=0; k<16 && d>-1e15 && d<1e15 && (d!=0 || 1/d>0); k++) {
+			double m=d*POW10[k];
+			if (m<=-9e15 || m>=9e15) {
+				break;
+			}
+			long long l=(long long) ((m<0) ? m-0.5 : m+0.5);
+			if ((double) l/POW10[k]!=d) {
+				continue;
+			}
+			char tmp[24];
+			char * q=tmp+sizeof(tmp);
+			unsigned long long u=(l<0) ? 0ull-(unsigned long long) l : (unsigned long long) l;
+			for (int digits=0; u!=0 || digits<=k; digits++) {
+				if (digits==k && k>0) {
+					*--q='.';
+				}
+				*--q=(char) ('0'+u%10);
+				u/=10;
+			}
+			if (l<0) {
+				*--q='-';
+			}
+			unsigned int n=tmp+sizeof(tmp)-q;
+			memcpy(p, q, n);
+			if (k==0) {
+				p[n++]='.';
+				p[n++]='0';
+			}
+			return n;
+		}
+		int n=snprintf(p, 32, "%.15g", d);
+		if (strtod(p, NULL)!=d) {
+			n=snprintf(p, 32, "%.16g", d);
+			if (strtod(p, NULL)!=d) {
+				n=snprintf(p, 32, "%.17g", d);
+			}
+		}
+		if (strpbrk(p, ".en")==NULL) {
+			p[n++]='.';
+			p[n++]='0';
+		}
+		return n;
+	}
+
+	std::string * s;
+	FILE * f;
+	char chunk[4096];
+	unsigned int used;
+	bool ok;
+};
+
+std::string eBottle::toString() const {
+	std::string s;
+	toString(s);
+	return s;
+}
+
+void eBottle::toString(std::string & s) const {
+	s.clear();
+	TextWriter w(&s);
+	fillString(w, this);
+}
+
+bool eBottle::print(FILE * f) const {
+	TextWriter w(f);
+	fillString(w, this);
+	w.flush();
+	return w.ok;
+}
+
+bool eBottle::fromString(const std::string& s) {
+	return fromString(s.c_str());
+}
+
+bool eBottle::fromString(const ConstString& s) {
+	return fromString(s.c_str());
+}
+
+bool eBottle::fromString(const char * txt) {
+	bool ok=true;
+	fromStr(this, txt, 0, ok);
+	return ok;
+}
+
+const eValue & eBottle::operator[](const unsigned int i) const {
+	return *values.at(i);
+}
+
+eValue & eBottle::operator[](const unsigned int i) {
+	return *getPtr(i);
+}
+
+eBottle::eBottle(const std::string& s){
+	init(NULL);
+	this->fromString(s.c_str());
+}
+
+eBottle::eBottle(const ConstString& s) {
+	init(NULL);
+	this->fromString(s.c_str());
+
+}
+
+eBottle::eBottle(const char * txt) {
+	init(NULL);
+	this->fromString(txt);
+}
+
+eBottle::eBottle(const eBottle & eb) {
+	init(NULL);
+	if (eb.isArena()) {
+		useArena();
+	}
+	this->copy(&eb);
+
+}
+
+eBottle::eBottle(eBottle && eb) {
+	init(NULL);
+	*this=std::move(eb);
+}
+
+eBottle & eBottle::operator=(eBottle && p) {
+	if (this==&p) {
+		return *this;
+	}
+	if ((p.arena!=NULL && !p.ownArena) || (arena!=NULL && !ownArena)) {
+		// lists nested in an arena cannot change hands
+		copy(&p);
+		p.clear();
+		return *this;
+	}
+	p.changing();
+	clear();
+	if (ownArena) {
+		delete arena;
+	}
+	values=std::move(p.values);
+	arena=p.arena;
+	ownArena=p.ownArena;
+	std::swap(toBinaryPointer, p.toBinaryPointer);
+	std::swap(rxBuffer, p.rxBuffer);
+	std::swap(rxCapacity, p.rxCapacity);
+	std::swap(rxSize, p.rxSize);
+	rxOffsets.swap(p.rxOffsets);
+	viewMode=p.viewMode;
+	bigEndian=p.bigEndian;
+	compression=p.compression;
+	parallel=p.parallel;
+	for (unsigned int i=0; i<values.size(); i++) {
+		eValue * v=values[i];
+		v->owner=this;
+		if (v->type==eValue::BOTTLE && v->value.list.ptr->refs==1 && v->value.list.ptr->parent==&p) {
+			v->value.list.ptr->parent=this;
+		}
+	}
+	if (p.exposed) {
+		expose();
+	}
+	if (p.dirty) {
+		touch();
+	} else {
+		grow(p.global_size-EMPTY_SIZE);
+	}
+
+	// p is left as a new empty eBottle, still in the same place
+	p.arena=NULL;
+	p.ownArena=false;
+	p.values=std::vector< eValue *, eArenaAllocator<eValue *> >();
+	p.global_size=EMPTY_SIZE;
+	p.dirty=false;
+	p.indexed=0;
+	if (p.parent!=NULL) {
+		p.parent->touch();
+	}
+	return *this;
 }
-
-eBottle & eBottle::addList() {
-	eBottle* yb= new eBottle();
-	eValue * p = new eValue(yb);
-	values.push_back(p);
-	return *yb;
+/*
+ * Text parser
+ * 
+ * A single recursive descent pass over the text, in place. The grammar is
+ * 
+ *     list   := { value }
+ *     value  := number | word | "quoted" | ( list ) | { bytes } 
+ *             | [i numbers ] | [d numbers ]
+ * 
+ * Numbers with a '.' or an exponent are doubles, the rest integers 
+ * (0x prefixes hexadecimal); inf and nan are doubles only with a sign. 
+ * Words are strings that run up to a space or a delimiter. Quoted strings 
+ * may hold spaces and the escapes \" \\ \n \t and \r. Bytes are 
+ * numbers, or 0x followed by any amount of hex digit pairs.
+ * 
+ * Malformed text is parsed as far as it goes: tokens that are not valid 
+ * bytes or array numbers are dropped, stray closers are skipped and open 
+ * lists, blobs, arrays and strings end with the text, and ok is cleared.
+ */
+static inline bool isSpace(const char c) {
+	return c==' ' || c=='\t' || c=='\n' || c=='\r' || c=='\f' || c=='\v';
 }
 
-void eBottle::add(const eValue* yv) {
-	eValue * p = new eValue();
-	(*p)=*yv;
-	values.push_back(p);
+static inline bool isDelimiter(const char c) {
+	return c=='\0' || isSpace(c) || c=='(' || c==')' || c=='[' || c==']' || c=='{' || c=='}' || c=='"';
 }
 
-void eBottle::add(const eValue & yv) {
-	eValue * p = new eValue();
-	(*p)=yv;
-	values.push_back(p);
+static inline bool isDigit(const char c) {
+	return c>='0' && c<='9';
 }
 
-eValue * eBottle::getPtr(const unsigned int i) {
-	return values.at(i);
+static inline const char * skipSpace(const char * p) {
+	while (isSpace(*p)) {
+		p++;
+	}
+	return p;
 }
 
-eValue * eBottle::getPtr(const unsigned int i) const {
-	return values.at(i);
+static inline const char * tokenEnd(const char * p) {
+	while (!isDelimiter(*p)) {
+		p++;
+	}
+	return p;
 }
 
-eValue & eBottle::get(const unsigned int i) {
-	return *values.at(i);
+static inline int hexDigit(const char c) {
+	if (c>='0' && c<='9') {
+		return c-'0';
+	}
+	if (c>='a' && c<='f') {
+		return c-'a'+10;
+	}
+	if (c>='A' && c<='F') {
+		return c-'A'+10;
+	}
+	return -1;
 }
 
-eValue & eBottle::get(const unsigned int i) const {
-	return *values.at(i);
+// whether the token at p can only be a number
+static inline bool startsNumber(const char * p) {
+	if (*p=='-' || *p=='+') {
+		p++;
+	}
+	if (*p=='.') {
+		p++;
+	}
+	return isDigit(*p);
 }
 
-bool eBottle::write(ConnectionWriter& connection) {
-	int size=getBinarySize();
-	connection.appendInt(size);
-//	fprintf(stderr,"TX SIZE: %d\n",size);
-	char * tmp=new char[size];
-	toBinary(tmp);
-	connection.appendBlock(tmp, size);
-	delete[] tmp;
-	return true;
+/*
+ * Parses the number in [p,end). Returns 0 if it is not a number, 
+ * eValue::INT or eValue::DOUBLE otherwise.
+ */
+static int parseNumber(const char * p, const char * end, int & i, double & d) {
+	char * e;
+	if (!startsNumber(p)) {
+		// inf and nan, signed so that the words stay strings
+		if (*p!='-' && *p!='+') {
+			return 0;
+		}
+		const char * q=p+1;
+		if (*q!='i' && *q!='I' && *q!='n' && *q!='N') {
+			return 0;
+		}
+		d=strtod(p, &e);
+		return (e==end) ? eValue::DOUBLE : 0;
+	}
+	const char * q=(*p=='-' || *p=='+') ? p+1 : p;
+	int base=(q[0]=='0' && (q[1]=='x' || q[1]=='X')) ? 16 : 10;
+	long long l=strtoll(p, &e, base);
+	if (e==end && l>=INT_MIN && l<=INT_MAX) {
+		i=(int) l;
+		return eValue::INT;
+	}
+	d=strtod(p, &e);
+	if (e==end) {
+		return eValue::DOUBLE;
+	}
+	return 0;
 }
 
-bool eBottle::read(ConnectionReader& connection) {
-	this->clear();
-	int size=connection.expectInt();
-//	fprintf(stderr,"RX SIZE: %d\n",size);
-	const char * tmp=new char[size];
-	connection.expectBlock(tmp, size);
-	fromBinary(tmp, size);
-	delete[] tmp;
-	return !connection.isError();
+// reads a quoted string starting after the opening quote
+static const char * parseQuoted(const char * p, std::string & t, bool & ok) {
+	const char * run=p;
+	while (*p!='\0' && *p!='"') {
+		if (*p=='\\' && p[1]!='\0') {
+			t.append(run, p-run);
+			p++;
+			switch (*p) {
+				case 'n':
+					t+='\n';
+					break;
+				case 't':
+					t+='\t';
+					break;
+				case 'r':
+					t+='\r';
+					break;
+				default:
+					t+=*p;
+					break;
+			}
+			run=++p;
+		} else {
+			p++;
+		}
+	}
+	t.append(run, p-run);
+	if (*p!='"') {
+		ok=false;
+		return p;
+	}
+	return p+1;
 }
 
-void eBottle::remove(const unsigned int i) {
-	delete values.at(i);
-	values.erase(values.begin()+i);
+// whether the digits of [p,end), after 0x, come in hex pairs
+static bool isHexRun(const char * p, const char * end) {
+	if ((end-p)%2!=0) {
+		return false;
+	}
+	for (const char * h=p+2; h<end; h++) {
+		if (hexDigit(*h)<0) {
+			return false;
+		}
+	}
+	return true;
 }
 
-void eBottle::insert(const eValue *p, const unsigned int i) {
-	eValue * yv=new eValue();
-	*yv=*p;
-	values.insert(values.begin()+i, yv);
-}
-eBottle & eBottle::operator=(const eBottle & p) {
-	this->clear();
-	for (unsigned int i=0;i<p.values.size();i++) {
-		switch (p.getPtr(i)->getType()) {
-			case eValue::INT:
-			this->addInt(p.getPtr(i)->asInt());
-			break;
-			case eValue::DOUBLE:
-			this->addDouble(p.getPtr(i)->asDouble());
-			break;
-			case eValue::CHARP:
-			this->addBlob(p.getPtr(i)->asBlob(),p.getPtr(i)->getSize());
-			break;
-			case eValue::BOTTLE: {
-				eBottle * yb= this->addListPtr();
-				yb->operator=(*(p.getPtr(i)->asList()));
-				break;
-			}
-			case eValue::STRING: {
-				this->addString(p.getPtr(i)->asString().c_str());
-				break;
+// reads the bytes of a blob up to the closing brace
+static const char * parseBytes(const char * p, std::vector<char> & v, bool & ok) {
+	while (true) {
+		p=skipSpace(p);
+		if (*p=='}') {
+			return p+1;
+		}
+		if (isDelimiter(*p)) {
+			ok=false;
+			return p;
+		}
+		const char * end=tokenEnd(p);
+		int i=0;
+		double d;
+		// 0x and more than two digits is a run of bytes, otherwise a number
+		const bool run=end-p>4 && p[0]=='0' && (p[1]=='x' || p[1]=='X');
+		if (run && isHexRun(p, end)) {
+			for (const char * h=p+2; h<end; h+=2) {
+				v.push_back((char) (hexDigit(h[0])*16+hexDigit(h[1])));
 			}
+		} else if (!run && parseNumber(p, end, i, d)==eValue::INT && i>=-128 && i<=255) {
+			v.push_back((char) i);
+		} else {
+			ok=false;
 		}
+		p=end;
 	}
-	return *this;
 }
 
-void eBottle::copy(const eBottle *p) {
-	this->clear();
-	for (unsigned int i=0; i<p->count(); i++) {
-		switch (p->getPtr(i)->getType()) {
+// reads the numbers of an array up to the closing bracket
+template <class T> static const char * parseArray(const char * p, std::vector<T> & v, bool & ok) {
+	while (true) {
+		p=skipSpace(p);
+		if (*p==']') {
+			return p+1;
+		}
+		if (isDelimiter(*p)) {
+			ok=false;
+			return p;
+		}
+		const char * end=tokenEnd(p);
+		int i=0;
+		double d=0;
+		switch (parseNumber(p, end, i, d)) {
 			case eValue::INT:
-				this->addInt(p->getPtr(i)->asInt());
+				v.push_back((T) i);
 				break;
 			case eValue::DOUBLE:
-				this->addDouble(p->getPtr(i)->asDouble());
-				break;
-			case eValue::CHARP:
-				this->addBlob(p->getPtr(i)->asBlob(), p->getPtr(i)->getSize());
+				v.push_back((T) d);
 				break;
-			case eValue::BOTTLE: {
-				eBottle * yb= this->addListPtr();
-				yb->copy(p->getPtr(i)->asList());
-				break;
-			}
-			case eValue::STRING:
-				this->addString(p->getPtr(i)->asString());
+			default:
+				ok=false;
 				break;
 		}
+		p=end;
 	}
 }
 
-const char * const eBottle::toBinary(int *size) const {
-	int global_size=0;
-	fill(this, global_size);
-	toBinaryPointer = new char[global_size];
-	global_size=0;
-	fill(this, global_size, toBinaryPointer);
-	*size=global_size;
-	return toBinaryPointer;
-}
-
-unsigned int eBottle::getBinarySize() const {
-	int size=0;
-	fill(this, size);
-	return size;
-
-}
-void eBottle::toBinary(char * p) const {
-	int global_size=0;
-	fill(this, global_size, p);
-}
-
-void eBottle::fromBinary(const char * p, const int size) {
-	int s=0;
-	reconstruct(this, s, (char *) p);
-	if (size!=s) {
-		fprintf(stderr,"Reconstruct error\n");
-	}
-}
-
-void eBottle::append(const eBottle & yb) {
-	for (unsigned int i=0; i<yb.count(); i++) {
-		this->add(yb.getPtr(i));
+// skips a list nested too deep, returning after its closing parenthesis
+static const char * skipList(const char * p) {
+	int level=1;
+	while (*p!='\0' && level>0) {
+		if (*p=='(') {
+			level++;
+		} else if (*p==')') {
+			level--;
+		}
+		p++;
 	}
+	return p;
 }
 
-void eBottle::fill(const eBottle * b, int &s, char * p) const {
-	if (p!=NULL)
-		* (int*) (p+s) =b->count();
-	s+=sizeof(int);
-	for (unsigned int i=0; i<b->count(); i++) {
-		if (p!=NULL) {
-			* (int*) (p+s) = b->getPtr(i)->getType();
-		}
-		s+=sizeof(int);
-		switch (b->getPtr(i)->getType()) {
-			case eValue::INT: {
-				if (p!=NULL) {
-					*(int*) (p+s) =b->getPtr(i)->asInt();
+const char * eBottle::fromStr(eBottle * b, const char * p, const int depth, bool & ok) const {
+	while (true) {
+		p=skipSpace(p);
+		switch (*p) {
+			case '\0':
+				if (depth>0) {
+					// a list left open
+					ok=false;
 				}
-				s+=sizeof(int);
+				return p;
+			case ')':
+				if (depth>0) {
+					return p+1;
+				}
+				ok=false;
+				p++;
 				break;
-			}
-			case eValue::DOUBLE: {
-				if (p!=NULL)
-					* (double*) (p+s)=b->getPtr(i)->asDouble();
-				s+=sizeof(double);
+			case '(':
+				if (depth>=MAX_DEPTH) {
+					ok=false;
+					p=skipList(p+1);
+				} else {
+					p=fromStr(b->newList(), p+1, depth+1, ok);
+				}
+				break;
+			case '{': {
+				std::vector<char> v;
+				p=parseBytes(p+1, v, ok);
+				b->addBlob(v.data(), v.size());
 				break;
 			}
-			case eValue::CHARP: {
-				if (p!=NULL)
-					* (int*) (p+s)=b->getPtr(i)->getSize();
-				s+=sizeof(int);
-				if (p!=NULL)
-					memcpy(p+s, b->getPtr(i)->asBlob(), b->getPtr(i)->getSize());
-				s+=b->getPtr(i)->getSize();
+			case '[': {
+				p=skipSpace(p+1);
+				if (*p=='d') {
+					std::vector<double> v;
+					p=parseArray(tokenEnd(p), v, ok);
+					b->addDoubleArray(v.data(), v.size());
+				} else {
+					std::vector<int> v;
+					p=parseArray((*p=='i') ? tokenEnd(p) : p, v, ok);
+					b->addIntArray(v.data(), v.size());
+				}
 				break;
 			}
-			case eValue::BOTTLE: {
-				eBottle * q=b->getPtr(i)->asList();
-				fill(q, s, p);
+			case '"': {
+				std::string t;
+				p=parseQuoted(p+1, t, ok);
+				b->addString(std::move(t));
 				break;
 			}
-			case eValue::STRING: {
-				int str_len=strlen(b->getPtr(i)->asString().c_str())+1;
-				if (p!=NULL)
-					* (int*) (p+s)=str_len;
-				s+=sizeof(int);
-				if (p!=NULL)
-					memcpy(p+s, b->getPtr(i)->asString().c_str(), str_len);
-				s+=str_len;
+			case '}':
+			case ']':
+				ok=false;
+				p++;
+				break;
+			default: {
+				const char * end=tokenEnd(p);
+				int i;
+				double d;
+				switch (parseNumber(p, end, i, d)) {
+					case eValue::INT:
+						b->addInt(i);
+						break;
+					case eValue::DOUBLE:
+						b->addDouble(d);
+						break;
+					default:
+						b->addString(std::string(p, end-p));
+						break;
+				}
+				p=end;
 				break;
 			}
 		}
 	}
 }
 
-void eBottle::reconstruct(eBottle * b, int & s, char * p) const {
-	unsigned int n_elem_bottle = * (int*) (p+s);
-	s+=sizeof(int);
-	for (unsigned int i=0; i<n_elem_bottle; i++) {
-		int * j = (int*) (p+s); //type
-		s+=sizeof(int);
-		switch (*j) {
+// strings that would not read back as the same word are quoted
+void eBottle::TextWriter::putString(const std::string & t) {
+	int i;
+	double d;
+	const char * end=t.c_str()+t.length();
+	bool quote=t.empty() || startsNumber(t.c_str()) || parseNumber(t.c_str(), end, i, d)!=0;
+	for (unsigned int j=0; j<t.length() && !quote; j++) {
+		quote=isDelimiter(t[j]) || t[j]=='\\';
+	}
+	if (!quote) {
+		put(t.data(), t.length());
+		return;
+	}
+	put('"');
+	const char * run=t.c_str();
+	for (const char * q=run; q<end; q++) {
+		const char * escape;
+		switch (*q) {
+			case '"':
+				escape="\\\"";
+				break;
+			case '\\':
+				escape="\\\\";
+				break;
+			case '\n':
+				escape="\\n";
+				break;
+			case '\t':
+				escape="\\t";
+				break;
+			case '\r':
+				escape="\\r";
+				break;
+			default:
+				continue;
+		}
+		put(run, q-run);
+		put(escape, 2);
+		run=q+1;
+	}
+	put(run, end-run);
+	put('"');
+}
+
+void eBottle::fillString(TextWriter & w, const eBottle * b) const {
+	static const char HEX[]="0123456789abcdef";
+	for (unsigned int i=0; i<b->values.size(); i++) {
+		const eValue * v=b->values[i];
+		if (i>0) {
+			w.put(' ');
+		}
+		switch (v->getType()) {
 			case eValue::INT: {
-				b->addInt(* (int*) (p+s) );
-				s+=sizeof(int);
+				w.putInt(v->asInt());
 				break;
 			}
 			case eValue::DOUBLE: {
-				b->addDouble(* (double*) (p+s));
-				s+=sizeof(double);
+				w.putDouble(v->asDouble());
 				break;
 			}
 			case eValue::CHARP: {
-				int dim=(* (int*) (p+s));
-				s+=sizeof(int);
-				b->addBlob(p+s, dim);
-				s+=dim;
+				// bytes in hex, {0x0aff00}
+				w.put('{');
+				const unsigned char * elem=(const unsigned char *) v->asBlob();
+				if (v->getSize()>0) {
+					w.put("0x", 2);
+				}
+				for (unsigned int j=0; j<v->getSize(); j++) {
+					w.put(HEX[elem[j]>>4]);
+					w.put(HEX[elem[j] & 15]);
+				}
+				w.put('}');
 				break;
 			}
 			case eValue::BOTTLE: {
-				eBottle * q=b->addListPtr();
-				reconstruct(q, s, p);
+				w.put('(');
+				b->fillString(w, v->asList());
+				w.put(')');
 				break;
 			}
 			case eValue::STRING: {
-				int strlen=( * (int*) (p+s) );
-				s+=sizeof(int);
-				b->addString(p+s);
-				s+=strlen;
+				w.putString(*v->str());
+				break;
+			}
+			case eValue::INT_ARRAY: {
+				w.put("[i", 2);
+				const int * elem=v->asIntArray();
+				for (unsigned int j=0; j<v->asArrayLength(); j++) {
+					w.put(' ');
+					w.putInt(elem[j]);
+				}
+				w.put(']');
+				break;
+			}
+			case eValue::DOUBLE_ARRAY: {
+				w.put("[d", 2);
+				const double * elem=v->asDoubleArray();
+				for (unsigned int j=0; j<v->asArrayLength(); j++) {
+					w.put(' ');
+					w.putDouble(elem[j]);
+				}
+				w.put(']');
 				break;
 			}
+			default:
+				// empty eValues have no text form, see operator=(eValue &&)
+				break;
 		}
 	}
 }
 
-std::string eBottle::toString() const {
-	std::ostringstream s;
-	fillString(&s, this);
-	return s.str();
+
+void eBottle::setViewMode(const bool enable) {
+	viewMode=enable;
 }
-void eBottle::fromString(const std::string& s) {
-	fromString(s.c_str());
+
+bool eBottle::isViewMode() const {
+	return viewMode;
 }
 
-void eBottle::fromString(const ConstString& s) {
-	fromString(s.c_str());
+eBottleView eBottle::view() const {
+	eBottleView v(rxBuffer, rxSize);
+	if (rxOffsets.size()==v.n) {
+		// random access in constant time
+		v.offsets=rxOffsets.data();
+	}
+	return v;
 }
 
-void eBottle::fromString(const char * txt) {
-	std::string s;
-	s+="EBOTTLE ";
-	bool addSpace=false;
-	for (unsigned int i=0; i< strlen(txt); i++) {
-		if (txt[i]=='(' || txt[i]==')' || txt[i]=='{' || txt[i]=='}') {
-			addSpace=true;
-		}
-		if (addSpace)
-			s+=" ";
-		s+=(char) txt[i];
-		if (addSpace)
-			s+=" ";
-		addSpace=false;
-	}
-	char s2[] = " ";
-	char *ptr;
-	ptr = strtok( (char*) s.c_str(), s2);
-	fromStr(this, s2);
-}
-
-eValue & eBottle::operator[](const unsigned int i) const {
-	return *values.at(i);
+/*
+ * Views keep the layout of their buffer in a few bits
+ */
+static const unsigned char VIEW_ALIGNED=1;
+static const unsigned char VIEW_SWAP=2;
+
+// size in bytes of the value whose type tag is at p, tag included
+static int valueLength(const char * p, const unsigned char layout) {
+	const bool swap=(layout & VIEW_SWAP)!=0;
+	const bool aligned=(layout & VIEW_ALIGNED)!=0;
+	int s=sizeof(int);
+	switch (getInt(p, swap)) {
+		case eValue::INT:
+			s+=sizeof(int);
+			break;
+		case eValue::DOUBLE:
+			s+=aligned ? sizeof(int)+sizeof(double) : sizeof(double);
+			break;
+		case eValue::CHARP:
+		case eValue::STRING:
+			s+=sizeof(int)+getInt(p+s, swap);
+			break;
+		case eValue::CHARP|COMPRESSED:
+		case eValue::STRING|COMPRESSED:
+			s+=2*sizeof(int)+getInt(p+s, swap);
+			break;
+		case eValue::INT_ARRAY:
+			s+=sizeof(int)+getInt(p+s, swap)*sizeof(int);
+			break;
+		case eValue::DOUBLE_ARRAY:
+			s+=sizeof(int)+getInt(p+s, swap)*sizeof(double);
+			break;
+		case eValue::BOTTLE: {
+			int n=getInt(p+s, swap);
+			s+=sizeof(int);
+			for (int i=0; i<n; i++) {
+				s+=valueLength(p+s, layout);
+			}
+			break;
+		}
+	}
+	return aligned ? pad8(s) : s;
 }
 
-eValue & eBottle::operator[](const unsigned int i) {
-	return *values.at(i);
+eValueView::eValueView() {
+	p=NULL;
+	layout=0;
 }
 
-eBottle::eBottle(const std::string& s){
-	toBinaryPointer=NULL;
-	this->fromString(s.c_str());
+eValueView::eValueView(const char * q, const unsigned char l) {
+	p=q;
+	layout=l;
 }
 
-eBottle::eBottle(const ConstString& s) {
-	toBinaryPointer=NULL;
-	this->fromString(s.c_str());
+eValue::ValueType eValueView::getType() const {
+	if (p==NULL) {
+		return eValue::EMPTY;
+	}
+	return (eValue::ValueType) (getInt(p, layout & VIEW_SWAP) & ~COMPRESSED);
+}
 
+bool eValueView::isCompressed() const {
+	return p!=NULL && (getInt(p, layout & VIEW_SWAP) & COMPRESSED)!=0;
 }
 
-eBottle::eBottle(const char * txt) {
-	toBinaryPointer=NULL;
-	this->fromString(txt);
+bool eValueView::isInt() const {
+	return getType()==eValue::INT;
 }
 
-eBottle::eBottle(const eBottle & eb) {
-	toBinaryPointer=NULL;
-	this->copy(&eb);
+bool eValueView::isDouble() const {
+	return getType()==eValue::DOUBLE;
+}
 
+bool eValueView::isBlob() const {
+	return getType()==eValue::CHARP;
 }
-void eBottle::fromStr(eBottle *b, const char * s2) const {
-	char * ptr = strtok(NULL, s2);
-	bool beginBlob=false;
-	std::vector<char> v;
-	while (ptr != NULL) {
-		if (*ptr >= 'A' && *ptr <= 'z') {
-			b->addString(ptr);
-		} else if (*ptr=='(') {
-			eBottle * p = b->addListPtr();
-			fromStr(p, s2);
-		} else if (*ptr==')') {
-			return;
-		} else if (*ptr=='{') {
-			beginBlob=true;
-		} else if (*ptr=='}') {
-			beginBlob=false;
-			char tmp[v.size()];
-			for (unsigned int i=0; i<v.size(); i++) {
-				tmp[i]=v.at(i);
-			}
-			b->addBlob((char *)tmp, v.size());
-		} else {
-			if (beginBlob) {
-				v.push_back(atoi(ptr));
-			} else {
-				if (strstr(ptr, ".")==NULL) {
-					b->addInt(atoi(ptr));
-				} else {
-					b->addDouble(atof(ptr));
-				}
-			}
-		}
-		ptr = strtok(NULL, s2);
+
+bool eValueView::isList() const {
+	return getType()==eValue::BOTTLE;
+}
+
+bool eValueView::isString() const {
+	return getType()==eValue::STRING;
+}
+
+bool eValueView::isIntArray() const {
+	return getType()==eValue::INT_ARRAY;
+}
+
+bool eValueView::isDoubleArray() const {
+	return getType()==eValue::DOUBLE_ARRAY;
+}
+
+int eValueView::asInt() const {
+	return getInt(p+sizeof(int), layout & VIEW_SWAP);
+}
+
+double eValueView::asDouble() const {
+	int at=(layout & VIEW_ALIGNED) ? 2*sizeof(int) : sizeof(int);
+	return getDouble(p+at, layout & VIEW_SWAP);
+}
+
+const char * eValueView::asBlob() const {
+	return isCompressed() ? NULL : p+2*sizeof(int);
+}
+
+unsigned int eValueView::asBlobLength() const {
+	return getInt(p+(isCompressed() ? 2 : 1)*sizeof(int), layout & VIEW_SWAP);
+}
+
+void eValueView::asBlob(char * b) const {
+	if (isCompressed()) {
+		eCompress::decompress(b, asBlobLength(), p+3*sizeof(int), getInt(p+sizeof(int), layout & VIEW_SWAP));
+	} else {
+		memcpy(b, p+2*sizeof(int), asBlobLength());
 	}
 }
 
-void eBottle::fillString(std::ostringstream * s, const eBottle *b) const {
-	for (unsigned int i=0; i<b->values.size(); i++) {
-		switch (b->getPtr(i)->getType()) {
-			case eValue::INT: {
-				int v=b->getPtr(i)->asInt();
-				*s << v;
-				break;
-			}
-			case eValue::DOUBLE: {
-				double v = b->getPtr(i)->asDouble();
-				*s << v;
-				break;
-			}
-			case eValue::CHARP: {
-				*s << "{";
-				char * elem=b->getPtr(i)->asBlob();
-				unsigned int j;
-				for (j=0; j<b->getPtr(i)->getSize()-1; j++) {
-					*s << (int) elem[j] << " ";
-				}
-				*s << (int) elem[j] << "}";
-				break;
-			}
-			case eValue::BOTTLE: {
-				*s << "(";
-				eBottle *c= b->getPtr(i)->asList();
-				b->fillString(s, c);
-				*s << ")";
-				break;
-			}
-			case eValue::STRING: {
-				*s << b->getPtr(i)->asString().c_str();
-				break;
-			}
+eBottleView eValueView::asList() const {
+	return eBottleView(p+sizeof(int), valueLength(p, layout)-sizeof(int), layout);
+}
+
+const char * eValueView::asString() const {
+	return isCompressed() ? NULL : p+2*sizeof(int);
+}
+
+const char * eValueView::asArray() const {
+	return p+2*sizeof(int);
+}
+
+unsigned int eValueView::asArrayLength() const {
+	return getInt(p+sizeof(int), layout & VIEW_SWAP);
+}
+
+const int * eValueView::asIntArray() const {
+	const char * a=asArray();
+	if (layout!=VIEW_ALIGNED || ((uintptr_t) a)%alignof(int)!=0) {
+		return NULL;
+	}
+	return (const int *) a;
+}
+
+const double * eValueView::asDoubleArray() const {
+	const char * a=asArray();
+	if (layout!=VIEW_ALIGNED || ((uintptr_t) a)%alignof(double)!=0) {
+		return NULL;
+	}
+	return (const double *) a;
+}
+
+void eValueView::asIntArray(int * i) const {
+	copyArray((char *) i, asArray(), eValue::INT_ARRAY, asArrayLength()*sizeof(int), layout & VIEW_SWAP);
+}
+
+void eValueView::asDoubleArray(double * d) const {
+	copyArray((char *) d, asArray(), eValue::DOUBLE_ARRAY, asArrayLength()*sizeof(double), layout & VIEW_SWAP);
+}
+
+void eValueView::asFloatArray(float * f) const {
+	unsigned int n=asArrayLength();
+	if (!(layout & VIEW_SWAP)) {
+		eKernels::narrow(f, asArray(), n);
+		return;
+	}
+	// swapped in small steps on the stack
+	double d[64];
+	for (unsigned int i=0; i<n; i+=64) {
+		unsigned int k=(n-i<64) ? n-i : 64;
+		eKernels::bswap64(d, asArray()+i*sizeof(double), k);
+		eKernels::narrow(f+i, d, k);
+	}
+}
+
+eBottleView::eBottleView() {
+	p=NULL;
+	bytes=0;
+	n=0;
+	first=0;
+	layout=0;
+	offsets=NULL;
+	last=0;
+	last_offset=0;
+}
+
+eBottleView::eBottleView(const char * q, const int size) {
+	p=q;
+	bytes=size;
+	layout=0;
+	first=sizeof(int);
+	n=0;
+	if (p!=NULL && size>=(int) sizeof(int)) {
+		eBottle::Cursor c(p, size);
+		if (c.aligned) {
+			layout=VIEW_ALIGNED | (c.swap ? VIEW_SWAP : 0);
+			first=EMPTY_SIZE;
 		}
-		if (i!=b->count()-1)
-			*s<< " ";
+		n=c.getInt();
+	}
+	offsets=NULL;
+	last=0;
+	last_offset=first;
+}
+
+// nested list, p points to the amount of values
+eBottleView::eBottleView(const char * q, const int size, const unsigned char l) {
+	p=q;
+	bytes=size;
+	layout=l;
+	first=sizeof(int);
+	n=getInt(p, layout & VIEW_SWAP);
+	offsets=NULL;
+	last=0;
+	last_offset=first;
+}
+
+unsigned int eBottleView::size() const {
+	return n;
+}
+
+eValueView eBottleView::get(const unsigned int i) const {
+	if (i>=n) {
+		return eValueView();
 	}
+	if (offsets!=NULL) {
+		return eValueView(p+offsets[i], layout);
+	}
+	if (i<last) {
+		last=0;
+		last_offset=first;
+	}
+	while (last<i) {
+		last_offset+=valueLength(p+last_offset, layout);
+		last++;
+	}
+	return eValueView(p+last_offset, layout);
+}
+
+eValueView eBottleView::operator[](const unsigned int i) const {
+	return get(i);
+}
+
+const char * eBottleView::data() const {
+	return p;
 }
 
+int eBottleView::length() const {
+	return bytes;
+}
@@ -49,9 +49,14 @@
 #define YARPBOTTLE_H_
 
 #include <yarp/os/all.h>
+#include <algorithm>
 #include <string>
-#include <sstream>
+#include <cstdio>
 #include <vector>
+#include <type_traits>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
 
 /** 
  * \brief YARP namespace
@@ -69,6 +74,209 @@ namespace yarp {
 
 		class eBottle;
 
+		/**
+		 * \brief C++ types that eBottle::add, addAll and get take
+		 * 
+		 * Specialized below for int, double, const char *, std::string, 
+		 * const eBottle * (nested lists, copied when added), std::vector<int> 
+		 * and std::vector<double>.
+		 */
+		template <class T> struct eTypeTraits {
+			static const bool value = false;
+		};
+
+		/**
+		 * \brief Growable memory arena
+		 * 
+		 * Memory is taken from a list of chunks by simply moving a cursor 
+		 * forward, so consecutive allocations are contiguous. Nothing is 
+		 * released individually: reset() makes all the memory available 
+		 * again at once, keeping a single chunk as big as the high water 
+		 * mark so the next fill does not need to grow.
+		 * 
+		 * It is used by eBottle in arena mode (see eBottle::useArena).
+		 */
+		class eArena {
+			public:
+				/**
+				 * \brief Default constructor
+				 * 
+				 * \param[in] chunk The size in bytes of the first chunk
+				 */
+				eArena(const size_t chunk = 4096);
+
+				/**
+				 * \brief Class destructor
+				 * 
+				 * Frees all the chunks
+				 */
+				~eArena();
+
+				/**
+				 * Takes memory from the arena
+				 * 
+				 * \param[in] n The amount of bytes needed
+				 * \param[in] align The alignment of the returned pointer
+				 * \return A pointer to the memory, valid until reset()
+				 */
+				void * allocate(const size_t n, const size_t align = sizeof(double));
+
+				/**
+				 * Makes sure the next \p n bytes will be taken from a single chunk
+				 * 
+				 * \param[in] n The amount of bytes to reserve
+				 */
+				void reserve(const size_t n);
+
+				/**
+				 * Releases all the memory taken from the arena
+				 */
+				void reset();
+
+				/**
+				 * Access to the arena usage
+				 * 
+				 * \return The amount of bytes taken since the last reset()
+				 */
+				size_t used() const;
+
+			private:
+				eArena(const eArena &);
+				eArena & operator=(const eArena &);
+				void grow(const size_t n);
+
+				struct Chunk {
+					char * base;
+					size_t size;
+				};
+				std::vector<Chunk> chunks;
+				size_t current;
+				size_t offset;
+				size_t total;
+				// objects in the arena that still need their destructor 
+				unsigned int live;
+
+				friend class eBottle;
+		};
+
+		/**
+		 * \brief Per-thread pool of small memory blocks
+		 * 
+		 * eValues, eBottles created with new (nested lists included), long 
+		 * shared strings, blobs and the value lists of eBottles not in 
+		 * arena mode take their memory from here when it is at most 
+		 * MAX_BLOCK bytes. Each thread keeps free lists of blocks in power 
+		 * of 2 sizes, so clearing and rebuilding a message of the same 
+		 * shape is served from the lists instead of the heap. A block 
+		 * freed by another thread joins the lists of that thread.
+		 * 
+		 * Each thread retains at most getLimit() bytes and gives the rest 
+		 * back to the heap. Strings shorter than 256 characters keep their 
+		 * characters in a std::string, which does not use the pool.
+		 */
+		class ePool {
+			public:
+				/**
+				 * \brief Usage counters of the calling thread
+				 */
+				struct Stats {
+					/// Allocations served from the free lists
+					unsigned long hits;
+					/// Allocations that went to the heap
+					unsigned long misses;
+					/// Bytes kept in the free lists
+					size_t retained;
+				};
+
+				/// Size of the biggest block kept in the pool
+				static const size_t MAX_BLOCK=4096;
+
+				/**
+				 * Takes a block
+				 * 
+				 * \param[in] n The size of the block in bytes
+				 * \return The block, aligned as with operator new
+				 */
+				static void * allocate(const size_t n);
+
+				/**
+				 * Gives a block back
+				 * 
+				 * \param[in] p A block taken with allocate, or NULL
+				 * \param[in] n The size it was taken with
+				 */
+				static void deallocate(void * p, const size_t n);
+
+				/**
+				 * Access to the counters of the calling thread
+				 * 
+				 * \return The counters since the thread started or the last 
+				 * resetStats()
+				 */
+				static Stats stats();
+
+				/**
+				 * Zeroes the hits and misses of the calling thread
+				 */
+				static void resetStats();
+
+				/**
+				 * Gives all the blocks retained by the calling thread back to 
+				 * the heap
+				 */
+				static void trim();
+
+				/**
+				 * Sets the maximum amount of bytes each thread retains
+				 * 
+				 * \param[in] bytes The limit, 0 to disable the pool
+				 */
+				static void setLimit(const size_t bytes);
+
+				/**
+				 * Access to the maximum amount of bytes each thread retains
+				 * 
+				 * \return The limit, 1 MB by default
+				 */
+				static size_t getLimit();
+		};
+
+		/**
+		 * \brief Allocator for containers living in an eArena
+		 * 
+		 * Falls back to the ePool when no arena is given.
+		 */
+		template <class T> class eArenaAllocator {
+			public:
+				typedef T value_type;
+				typedef std::true_type propagate_on_container_copy_assignment;
+				typedef std::true_type propagate_on_container_move_assignment;
+				typedef std::true_type propagate_on_container_swap;
+
+				eArenaAllocator(eArena * a = NULL) : arena(a) {}
+				template <class U> eArenaAllocator(const eArenaAllocator<U> & o) : arena(o.arena) {}
+
+				T * allocate(const size_t n) {
+					if (arena!=NULL) {
+						return (T*) arena->allocate(n*sizeof(T), alignof(T));
+					}
+					return (T*) ePool::allocate(n*sizeof(T));
+				}
+				void deallocate(T * p, const size_t n) {
+					if (arena==NULL) {
+						ePool::deallocate(p, n*sizeof(T));
+					}
+				}
+				template <class U> bool operator==(const eArenaAllocator<U> & o) const {
+					return arena==o.arena;
+				}
+				template <class U> bool operator!=(const eArenaAllocator<U> & o) const {
+					return arena!=o.arena;
+				}
+
+				eArena * arena;
+		};
+
 		/**
 		 * \brief Single efficient Value class
 		 * 
@@ -85,11 +293,14 @@ namespace yarp {
 				 * These are the simple value types that can be transmitted
 				 */
 				enum ValueType {
-					INT = 1, ///< Integer data  
+					EMPTY = 0, ///< No data
+					INT, ///< Integer data  
 					DOUBLE, ///< Double precission floating point data  
 					CHARP, ///< Blob of bytes
 					BOTTLE, ///< List of eValues 
-					STRING ///< String of characters
+					STRING, ///< String of characters
+					INT_ARRAY, ///< Array of integers
+					DOUBLE_ARRAY ///< Array of doubles
 				};
 
 			public:
@@ -168,6 +379,61 @@ namespace yarp {
 				 */
 				eValue(const std::string& s);
 
+				/**
+				 * \brief Copy constructor
+				 * 
+				 * Creates an eValue as a copy of another one
+				 * \param[in] p The source eValue to copy
+				 */
+				eValue(const eValue & p);
+
+				/**
+				 * \brief Move constructor
+				 * 
+				 * Creates an eValue taking the data of another one, which is 
+				 * left empty. Data living in the arena of an eBottle is copied.
+				 * \param[in] p The source eValue
+				 */
+				eValue(eValue && p);
+
+				/**
+				 * \brief String eValue constructor
+				 * 
+				 * Creates an eValue with a string, taking the characters of \p s.
+				 * \param[in] s The string to store
+				 */
+				eValue(std::string && s);
+
+				/**
+				 * \brief Blob eValue constructor
+				 * 
+				 * Creates an eValue with a blob of bytes, taking ownership of 
+				 * the memory instead of copying it.
+				 * \param[in] p The blob, allocated with new[]
+				 * \param[in] size_p The size of the memory blob in bytes
+				 */
+				eValue(std::unique_ptr<char[]> p, const unsigned int size_p);
+
+				/**
+				 * \brief Integer array eValue constructor
+				 * 
+				 * Creates an eValue with a copy of an array of integers, kept 
+				 * in a single block of memory.
+				 * \param[in] p A pointer to the first integer
+				 * \param[in] n The amount of integers in the array
+				 */
+				eValue(const int * p, const unsigned int n);
+
+				/**
+				 * \brief Double array eValue constructor
+				 * 
+				 * Creates an eValue with a copy of an array of doubles, kept 
+				 * in a single block of memory.
+				 * \param[in] p A pointer to the first double
+				 * \param[in] n The amount of doubles in the array
+				 */
+				eValue(const double * p, const unsigned int n);
+
 				/**
 				 * \brief Class destructor
 				 * 
@@ -178,10 +444,40 @@ namespace yarp {
 				/**
 				 * Assignation operator
 				 * 
+				 * Blobs, lists and long strings are not copied: both eValues 
+				 * share them until one of them asks for a non-const pointer 
+				 * to the data (copy-on-write). Lists that have been handed out 
+				 * that way, or by eBottle::addList, and the lists holding them 
+				 * are copied instead, one level at a time, as they may still 
+				 * be modified through the pointer. The lists below them that 
+				 * were never handed out are still shared.
+				 * 
 				 * \param p The source  eValue to copy 
 				 */
 				eValue & operator=(const eValue & p);
 
+				/**
+				 * Move assignation operator
+				 * 
+				 * Takes the data of \p p, which is left empty. Data living in 
+				 * the arena of an eBottle is copied.
+				 * 
+				 * An empty eValue has no text form, so a slot of an eBottle 
+				 * moved from must be removed or assigned again before the 
+				 * eBottle goes through toString() and fromString().
+				 * 
+				 * \param p The source eValue
+				 */
+				eValue & operator=(eValue && p);
+
+				/**
+				 * eValues created with new take their memory from the ePool
+				 */
+				static void * operator new(size_t n);
+				static void * operator new(size_t n, void * p);
+				static void operator delete(void * p, size_t n);
+				static void operator delete(void * p, void * q);
+
 				/**
 				 * Access to eValue type
 				 * 
@@ -231,6 +527,28 @@ namespace yarp {
 				 */
 				bool isString() const;
 
+				/**
+				 * Checks wheather the eValue holds an array of integers or not
+				 * 
+				 * \return True if the eValue type is eValue::INT_ARRAY. Otherwise, false.
+				 */
+				bool isIntArray() const;
+
+				/**
+				 * Checks wheather the eValue holds an array of doubles or not
+				 * 
+				 * \return True if the eValue type is eValue::DOUBLE_ARRAY. Otherwise, false.
+				 */
+				bool isDoubleArray() const;
+
+				/**
+				 * Checks whether the blob, array, list or string of the eValue is 
+				 * shared with other eValues
+				 * 
+				 * \return True if other eValues hold the same data
+				 */
+				bool isShared() const;
+
 				/**
 				 * Access to the eValue data as an integer
 				 * 
@@ -250,7 +568,7 @@ namespace yarp {
 				 * 
 				 * \return A constant pointer to the integer inside the eValue
 				 */
-				int* asIntPtr() const;
+				const int* asIntPtr() const;
 
 				/**
 				 * Access to the eValue data as an double
@@ -271,11 +589,14 @@ namespace yarp {
 				 * 
 				 * \return A constant pointer to the double inside the eValue
 				 */
-				double* asDoublePtr() const;
+				const double* asDoublePtr() const;
 
 				/**
 				 * Access to the eValue data as an blob
 				 * 
+				 * If the blob is shared with other eValues, this eValue gets 
+				 * its own copy first.
+				 * 
 				 * \return A pointer to the blob inside the eValue
 				 */
 				char * asBlob();
@@ -285,7 +606,7 @@ namespace yarp {
 				 * 
 				 * \return A constant pointer to the blob inside the eValue
 				 */
-				char * asBlob() const;
+				const char * asBlob() const;
 
 				/**
 				 * Access to the eValue data size as a blob
@@ -297,6 +618,12 @@ namespace yarp {
 				/**
 				 * Access to the eValue data as a list
 				 * 
+				 * If the list is shared with other eValues, this eValue gets 
+				 * its own copy first. Only the top level of the list is copied:
+				 * the nested lists and blobs are still shared. As the pointer 
+				 * may be kept, copies of this eValue made afterwards get a 
+				 * list of their own instead of sharing it.
+				 * 
 				 * \return A pointer to the list inside the eValue
 				 */
 				eBottle * asList();
@@ -304,9 +631,11 @@ namespace yarp {
 				/**
 				 * Access to the eValue data as a list
 				 * 
+				 * The list may be shared with other eValues.
+				 * 
 				 * \return A constant pointer to the list inside the eValue
 				 */
-				eBottle * asList() const;
+				const eBottle * asList() const;
 
 				/**
 				 * Access to the eValue data as a string
@@ -318,10 +647,61 @@ namespace yarp {
 				/**
 				 * Access to the eValue data as a string
 				 * 
+				 * If the string is shared with other eValues, this eValue gets 
+				 * its own copy first.
+				 * 
 				 * \return A pointer to the string inside the eValue
 				 */
 				std::string* asStringPtr();
 
+				/**
+				 * Access to the eValue data as an array of integers
+				 * 
+				 * If the array is shared with other eValues, this eValue gets 
+				 * its own copy first.
+				 * 
+				 * \return A pointer to the first integer of the array
+				 */
+				int * asIntArray();
+
+				/**
+				 * Access to the eValue data as an array of integers
+				 * 
+				 * \return A constant pointer to the first integer of the array
+				 */
+				const int * asIntArray() const;
+
+				/**
+				 * Access to the eValue data as an array of doubles
+				 * 
+				 * If the array is shared with other eValues, this eValue gets 
+				 * its own copy first.
+				 * 
+				 * \return A pointer to the first double of the array
+				 */
+				double * asDoubleArray();
+
+				/**
+				 * Access to the eValue data as an array of doubles
+				 * 
+				 * \return A constant pointer to the first double of the array
+				 */
+				const double * asDoubleArray() const;
+
+				/**
+				 * Access to the eValue data size as an array
+				 * 
+				 * \return The amount of elements in the array
+				 */
+				unsigned int asArrayLength() const;
+
+				/**
+				 * Copies a double array converting the elements to floats
+				 * 
+				 * \param[out] f The place for asArrayLength() floats
+				 */
+				void asFloatArray(float * f) const;
+
 				/*
 				 * Access to the eValue data as a string
 				 * 
@@ -330,168 +710,703 @@ namespace yarp {
 				ConstString* asStringPtr() const;*/
 
 			private:
-				ValueType type;
+				struct SharedString;
+
+				// the payload lives in an eArena and must not be freed
+				static const unsigned char ARENA = 1;
+				// the string is kept in a SharedString
+				static const unsigned char SHARED = 2;
+				// the blob counter follows the data in the same block
+				static const unsigned char INLINE_COUNT = 4;
+				// strings from this length on are shared instead of copied
+				static const unsigned int SHARED_STRING = 256;
+
+				eValue(const unsigned char t, const char * p, const unsigned int size_p, eArena * a);
+				eValue(eBottle * p, eArena * a);
+				void allocBlob(const unsigned int size_p);
+				void detach();
+				void release();
+				void resized(const unsigned int before);
+				void changing();
+				bool isBlock() const;
+				static unsigned int elementSize(const int t);
+				std::string * str() const;
+
+				unsigned char type;
+				unsigned char flags;
 				unsigned int size;
-				void * value;
+				// the eBottle holding this eValue, which keeps its size when 
+				// it is assigned, or NULL
+				eBottle * owner;
+
+				/*
+				 * Integers and doubles are kept inline. Strings are built in 
+				 * place, so short ones do not need any heap memory either.
+				 * Only blobs, arrays, long strings and lists use the heap, and they are 
+				 * reference counted so copies share them until one is modified.
+				 */
+				union {
+					int i;
+					double d;
+					// blobs and arrays
+					struct {
+						char * data;
+						// NULL when the blob lives in an eArena
+						std::atomic<int> * refs;
+					} blob;
+					struct {
+						eBottle * ptr;
+					} list;
+					SharedString * shared;
+					char text[sizeof(std::string)];
+				} value;
+
+				friend class eBottle;
+				friend class eBottleDecoder;
+				template <class T> friend struct eTypeTraits;
 		};
 
+		class eBottleView;
+		class eBottleDecoder;
+
 		/**
-		 * \brief Efficient eValue list class
+		 * \brief Read only view of an eValue inside a binary buffer
 		 * 
-		 * This class is able to store an ordered list of eValues of different
-		 * types, including nested lists, and to transmit it using YARP.
-		 * 
-		 * The main difference between this implementation and the YARP default 
-		 * one is that this is not strictly human readable, which permits a faster 
-		 * and more efficient memory copy and yarp transmission.
-		 * 
-		 * Furthermore, using the efficient copy operator, most of the memory 
-		 * leaks that pointers may cause are avoided.
+		 * It is obtained from eBottleView::get and decodes the value directly
+		 * from the buffer produced by eBottle::toBinary, without copying it.
+		 * The buffer must outlive the view.
 		 */
-		class eBottle : public yarp::os::Portable {
+		class eValueView {
 			public:
 				/**
 				 * \brief Default constructor
 				 * 
-				 * Creates an empty eBottle.
+				 * Creates a view of an empty eValue
 				 */
-				eBottle();
+				eValueView();
 
 				/**
-				 * \brief String contructor
-				 * 
-				 * Creates an eBottle from a human readable string 
-				 * (in the same way YARP does).
+				 * \brief Buffer constructor
 				 * 
-				 * \param txt A pointer to the null terminated char array
+				 * \param[in] p A pointer to the type tag of the value in the buffer
+				 * \param[in] layout The layout of the buffer, as found by eBottleView
 				 */
-				eBottle(const char * txt);
+				eValueView(const char * p, const unsigned char layout = 0);
 
 				/**
-				 * \brief String contructor
-				 * 
-				 * Creates an eBottle from a human readable string 
-				 * (in the same way YARP does).
+				 * Access to the value type
 				 * 
-				 * \param s The string that represents the eBottle
+				 * \return The type of the data, eValue::EMPTY for an empty view
 				 */
-				eBottle(const std::string& s);
+				eValue::ValueType getType() const;
 
 				/**
-				 * \brief String contructor
-				 * 
-				 * Creates an eBottle from a human readable string 
-				 * (in the same way YARP does).
-				 * 
-				 * \param s The string that represents the eBottle
+				 * \return True if the value is an eValue::INT
 				 */
-				eBottle(const ConstString& s);
+				bool isInt() const;
 
 				/**
-				 * \brief Copy constructor
-				 * 
-				 * Creates an eBottle as a copy of another one
-				 * 
-				 * \param[in] eb The source eBottle to copy
+				 * \return True if the value is an eValue::DOUBLE
 				 */
-				eBottle(const eBottle & eb);
+				bool isDouble() const;
 
 				/**
-				 * \brief Class destructor
-				 * 
-				 * Frees al the memory used in the object.
+				 * \return True if the value is an eValue::CHARP
 				 */
-				virtual ~eBottle();
+				bool isBlob() const;
 
 				/**
-				 * \brief Copy function
-				 * 
-				 * Rebuilds the eBottle as a copy of another one
-				 * 
-				 * \param[in]  p A pointer to the eBottle to copy from.
+				 * \return True if the value is an eValue::BOTTLE
 				 */
-				void copy(const eBottle *p);
+				bool isList() const;
 
 				/**
-				 * \brief Assignation operator
-				 * 
-				 * Rebuilds the eBottle as a copy of another one
-				 * 
-				 * \param[in]  p A reference to the eBottle to copy from.
+				 * \return True if the value is an eValue::STRING
 				 */
-				eBottle & operator=(const eBottle & p);
+				bool isString() const;
 
 				/**
-				 * Removes all the eValues inside the eBottle.
+				 * \return True if the value is an eValue::INT_ARRAY
 				 */
-				virtual void clear();
+				bool isIntArray() const;
 
 				/**
-				 * Inserts a copy of the an eValue at the end of the eBottle
-				 * 
-				 * \param[in] e A pointer to the eValue to insert
+				 * \return True if the value is an eValue::DOUBLE_ARRAY
 				 */
-				void add(const eValue * e);
+				bool isDoubleArray() const;
 
 				/**
-				 * Inserts a copy of the an eValue at the end of the eBottle
+				 * Access to the value as an integer
 				 * 
-				 * \param[in] e A reference to the eValue to insert
+				 * \return A copy of the integer in the buffer
 				 */
-				void add(const eValue & e);
+				int asInt() const;
 
 				/**
-				 * Inserts an integer type eValue at the end of the eBottle
+				 * Access to the value as a double
 				 * 
-				 * \param[in] i The integer to insert
+				 * \return A copy of the double in the buffer
 				 */
-				void addInt(const int i);
+				double asDouble() const;
 
 				/**
-				 * Inserts a double type eValue at the end of the eBottle
+				 * Access to the value as a blob
 				 * 
-				 * \param[in] d The double to insert
+				 * \return A pointer to the blob inside the buffer, or NULL if 
+				 * it is compressed
 				 */
-				void addDouble(const double d);
+				const char * asBlob() const;
 
 				/**
-				 * Inserts a blob type eValue at the end of the eBottle,
-				 * making first a local copy of the memory
+				 * Access to the value size as a blob
 				 * 
-				 * \param[in] q A pointer to the blob
-				 * \param[in] size The size of the blob in bytes
+				 * \return The size of the blob (or string, with its null 
+				 * character) in bytes, once decompressed
 				 */
-				void addBlob(const char * q, const unsigned int size);
+				unsigned int asBlobLength() const;
 
 				/**
-				 * Inserts a string eValue at the end of the eBottle
+				 * Copies a blob or string out of the buffer, decompressing it 
+				 * if needed
 				 * 
-				 * \param[in] s The string to insert
+				 * \param[out] b The place for asBlobLength() bytes
 				 */
-				void addString(const std::string& s);
+				void asBlob(char * b) const;
 
 				/**
-				 * Inserts a string eValue at the end of the eBottle
+				 * Checks whether a blob or string is compressed in the buffer
 				 * 
-				 * \param[in] s The string to insert
+				 * \return True if it can only be read with asBlob(char *)
 				 */
-				void addString(const ConstString& s);
+				bool isCompressed() const;
 
 				/**
-				 * Inserts a string eValue at the end of the eBottle,
-				 * making first a copy local memory
+				 * Access to the value as a list
 				 * 
-				 * \param[in] s A pointer to the null terminated char array to insert
+				 * \return A view of the nested list
+				 */
+				eBottleView asList() const;
+
+				/**
+				 * Access to the value as a string
+				 * 
+				 * \return A pointer to the null terminated string inside the 
+				 * buffer, or NULL if it is compressed
+				 */
+				const char * asString() const;
+
+				/**
+				 * Access to the value as an array
+				 * 
+				 * The elements are raw wire data: they may be in the other 
+				 * byte order and, in the legacy layout, unaligned.
+				 * 
+				 * \return A pointer to the first element inside the buffer
+				 */
+				const char * asArray() const;
+
+				/**
+				 * Access to an integer array in place
+				 * 
+				 * \return A pointer to the first integer inside the buffer, or 
+				 * NULL if the elements cannot be used in place (legacy layout, 
+				 * other byte order or unaligned buffer)
+				 */
+				const int * asIntArray() const;
+
+				/**
+				 * Access to a double array in place
+				 * 
+				 * \return A pointer to the first double inside the buffer, or 
+				 * NULL if the elements cannot be used in place (legacy layout, 
+				 * other byte order or unaligned buffer)
+				 */
+				const double * asDoubleArray() const;
+
+				/**
+				 * Access to the value size as an array
+				 * 
+				 * \return The amount of elements in the array
+				 */
+				unsigned int asArrayLength() const;
+
+				/**
+				 * Copies an integer array out of the buffer
+				 * 
+				 * \param[out] i The place for asArrayLength() integers
+				 */
+				void asIntArray(int * i) const;
+
+				/**
+				 * Copies a double array out of the buffer
+				 * 
+				 * \param[out] d The place for asArrayLength() doubles
+				 */
+				void asDoubleArray(double * d) const;
+
+				/**
+				 * Copies a double array out of the buffer converting the 
+				 * elements to floats
+				 * 
+				 * \param[out] f The place for asArrayLength() floats
+				 */
+				void asFloatArray(float * f) const;
+
+			private:
+				const char * p;
+				unsigned char layout;
+		};
+
+		/**
+		 * \brief Read only view of an eBottle binary representation
+		 * 
+		 * Wraps the buffer produced by eBottle::toBinary (or received by 
+		 * eBottle::read in view mode) and gives access to its contents 
+		 * without building any eValue. Nothing is decoded until it is 
+		 * asked for. Sequential access is linear; random access has to 
+		 * skip over the previous values.
+		 * 
+		 * The buffer must outlive the view. Nothing is checked while 
+		 * decoding, so buffers from untrusted sources must be checked first 
+		 * with eBottle::validate (eBottle::read does it in view mode).
+		 */
+		class eBottleView {
+			public:
+				/**
+				 * \brief Default constructor
+				 * 
+				 * Creates an empty view
+				 */
+				eBottleView();
+
+				/**
+				 * \brief Buffer constructor
+				 * 
+				 * \param[in] p A pointer to the binary representation
+				 * \param[in] size The size of the binary representation in bytes
+				 */
+				eBottleView(const char * p, const int size);
+
+				/**
+				 * Access to the list size
+				 * 
+				 * \return The amount of values in the list
+				 */
+				unsigned int size() const;
+
+				/**
+				 * Access to the list contents
+				 * 
+				 * \param[in] i A position inside the list
+				 * \return A view of the value at the \p i position, or an 
+				 * empty view if \p i is out of range
+				 */
+				eValueView get(const unsigned int i) const;
+
+				/**
+				 * Access to the list contents
+				 * 
+				 * \param[in] i A position inside the list
+				 * \return A view of the value at the \p i position
+				 */
+				eValueView operator[](const unsigned int i) const;
+
+				/**
+				 * Access to the viewed buffer
+				 * 
+				 * \return A pointer to the binary representation
+				 */
+				const char * data() const;
+
+				/**
+				 * Access to the viewed buffer size
+				 * 
+				 * \return The size of the binary representation in bytes
+				 */
+				int length() const;
+
+			private:
+				eBottleView(const char * p, const int size, const unsigned char layout);
+
+				const char * p;
+				int bytes;
+				unsigned int n;
+				// offset of the first value
+				int first;
+				unsigned char layout;
+				// offsets of the values, when known
+				const int * offsets;
+				// last position decoded, to make sequential access linear
+				mutable unsigned int last;
+				mutable int last_offset;
+
+				friend class eValueView;
+				friend class eBottle;
+		};
+
+		/**
+		 * \brief Efficient eValue list class
+		 * 
+		 * This class is able to store an ordered list of eValues of different
+		 * types, including nested lists, and to transmit it using YARP.
+		 * 
+		 * The main difference between this implementation and the YARP default 
+		 * one is that this is not strictly human readable, which permits a faster 
+		 * and more efficient memory copy and yarp transmission.
+		 * 
+		 * Furthermore, using the efficient copy operator, most of the memory 
+		 * leaks that pointers may cause are avoided.
+		 * 
+		 * Copies share nested lists, blobs and long strings until one of 
+		 * them is modified (see copy), except the lists handed out to be 
+		 * modified in place, by addList() or eValue::asList(), and the lists 
+		 * holding them. The reference may be kept and written at any time, 
+		 * so every copy gets its own copy of those lists, one level each, 
+		 * for as long as they live. A bottle built with addList() is thus 
+		 * copied in a time that grows with its lists, not with its top 
+		 * level. Lists built apart and inserted with add(&list), or parsed 
+		 * or received, are never handed out and stay shared.
+		 */
+		class eBottle : public yarp::os::Portable {
+			public:
+				/**
+				 * Blobs and strings of at least this size in bytes are sent 
+				 * by write() without being copied
+				 */
+				static const unsigned int EXTERNAL_BLOCK = 4096;
+
+				/**
+				 * Deepest nesting of lists accepted in binary representations
+				 */
+				static const int MAX_DEPTH = 256;
+
+				/**
+				 * Default compression threshold, see setCompression
+				 */
+				static const unsigned int COMPRESSION_THRESHOLD = 16384;
+
+				/**
+				 * Default parallel coding threshold, see setParallel
+				 */
+				static const unsigned int PARALLEL_THRESHOLD = 1<<20;
+
+				/**
+				 * Messages bigger than this are decoded by read() while they 
+				 * arrive, in chunks of this size in bytes
+				 */
+				static const int STREAM_CHUNK = 65536;
+
+				/**
+				 * Lookups by key in eBottles with at least this amount of 
+				 * values use a hash index, see find
+				 */
+				static const unsigned int INDEX_THRESHOLD = 16;
+
+				/**
+				 * \brief Default constructor
+				 * 
+				 * Creates an empty eBottle.
+				 */
+				eBottle();
+
+				/**
+				 * \brief String contructor
+				 * 
+				 * Creates an eBottle from a human readable string 
+				 * (in the same way YARP does).
+				 * 
+				 * \param txt A pointer to the null terminated char array
+				 */
+				eBottle(const char * txt);
+
+				/**
+				 * \brief String contructor
+				 * 
+				 * Creates an eBottle from a human readable string 
+				 * (in the same way YARP does).
+				 * 
+				 * \param s The string that represents the eBottle
+				 */
+				eBottle(const std::string& s);
+
+				/**
+				 * \brief String contructor
+				 * 
+				 * Creates an eBottle from a human readable string 
+				 * (in the same way YARP does).
+				 * 
+				 * \param s The string that represents the eBottle
+				 */
+				eBottle(const ConstString& s);
+
+				/**
+				 * \brief Copy constructor
+				 * 
+				 * Creates an eBottle as a copy of another one
+				 * 
+				 * \param[in] eb The source eBottle to copy
+				 */
+				eBottle(const eBottle & eb);
+
+				/**
+				 * \brief Move constructor
+				 * 
+				 * Creates an eBottle taking the contents of another one, which 
+				 * is left empty. No eValue is copied.
+				 * 
+				 * \param[in] eb The source eBottle
+				 */
+				eBottle(eBottle && eb);
+
+				/**
+				 * \brief Class destructor
+				 * 
+				 * Frees al the memory used in the object.
+				 */
+				virtual ~eBottle();
+
+				/**
+				 * \brief Copy function
+				 * 
+				 * Rebuilds the eBottle as a copy of another one.
+				 * 
+				 * Nested lists, blobs and long strings are shared with \p p 
+				 * (see eValue::operator=), so the cost depends only on the 
+				 * amount of eValues at the top level, plus the lists filled 
+				 * through eBottle::addList or eValue::asList, which are 
+				 * copied. In arena mode everything is copied into the arena 
+				 * instead.
+				 * 
+				 * \param[in]  p A pointer to the eBottle to copy from.
+				 */
+				void copy(const eBottle *p);
+
+				/**
+				 * \brief Assignation operator
+				 * 
+				 * Rebuilds the eBottle as a copy of another one, sharing its 
+				 * nested lists, blobs and long strings (see copy).
+				 * 
+				 * \param[in]  p A reference to the eBottle to copy from.
+				 */
+				eBottle & operator=(const eBottle & p);
+
+				/**
+				 * \brief Move assignation operator
+				 * 
+				 * Rebuilds the eBottle with the contents of another one, which 
+				 * is left empty. No eValue is copied, unless one of the two 
+				 * eBottles is a list nested in an arena.
+				 * 
+				 * \param[in]  p The eBottle to take the contents from.
+				 */
+				eBottle & operator=(eBottle && p);
+
+				/**
+				 * eBottles created with new take their memory from the ePool
+				 */
+				static void * operator new(size_t n);
+				static void * operator new(size_t n, void * p);
+				static void operator delete(void * p, size_t n);
+				static void operator delete(void * p, void * q);
+
+				/**
+				 * Removes all the eValues inside the eBottle.
+				 * 
+				 * In arena mode the memory is released at once, without 
+				 * visiting the eValues unless some of them are strings.
+				 */
+				virtual void clear();
+
+				/**
+				 * \brief Arena storage mode
+				 * 
+				 * Clears the eBottle and, when \p enable is true, makes it 
+				 * keep all its eValues, nested lists and blobs in a single 
+				 * growable eArena, laid out in the same order they are added.
+				 * Copies into an arena eBottle are written to one contiguous 
+				 * chunk and clear() only rewinds the arena.
+				 * 
+				 * Long strings still keep their characters in the heap.
+				 * 
+				 * \param[in] enable True to use an arena, false to go back 
+				 * to one heap allocation per eValue
+				 */
+				void useArena(const bool enable = true);
+
+				/**
+				 * Checks whether the eBottle stores its contents in an arena
+				 * 
+				 * \return True if the eBottle is in arena mode
+				 */
+				bool isArena() const;
+
+				/**
+				 * Inserts a copy of the an eValue at the end of the eBottle
+				 * 
+				 * \param[in] e A pointer to the eValue to insert
+				 */
+				void add(const eValue * e);
+
+				/**
+				 * Inserts a copy of the an eValue at the end of the eBottle
+				 * 
+				 * \param[in] e A reference to the eValue to insert
+				 */
+				void add(const eValue & e);
+
+				/**
+				 * Inserts an eValue at the end of the eBottle, taking its data
+				 * 
+				 * \param[in] e The eValue to insert, left empty
+				 */
+				void add(eValue && e);
+
+				/**
+				 * Inserts a value of a C++ type at the end of the eBottle, 
+				 * choosing the eValue type at compile time (see eTypeTraits)
+				 * 
+				 * \param[in] v The value to insert
+				 */
+				template <class T> typename std::enable_if<eTypeTraits<typename std::decay<T>::type>::value>::type add(const T & v) {
+					changing();
+					const unsigned int n=eTypeTraits<typename std::decay<T>::type>::append(*this, v);
+					if (n>0) {
+						grow(n);
+					}
+				}
+
+				/**
+				 * Inserts values of C++ types at the end of the eBottle, 
+				 * making room for all of them at once, see add
+				 * 
+				 * \param[in] v The values to insert
+				 */
+				template <class... T> void addAll(const T &... v) {
+					changing();
+					const size_t n=values.size()+sizeof...(T);
+					if (n>values.capacity()) {
+						values.reserve(std::max(n, 2*values.capacity()));
+					}
+					unsigned int added=0;
+					const int each[]={ 0, (added+=eTypeTraits<typename std::decay<T>::type>::append(*this, v), 0)... };
+					(void) each;
+					if (added>0) {
+						grow(added);
+					}
+				}
+
+				/**
+				 * Inserts an integer type eValue at the end of the eBottle
+				 * 
+				 * \param[in] i The integer to insert
+				 */
+				void addInt(const int i);
+
+				/**
+				 * Inserts a double type eValue at the end of the eBottle
+				 * 
+				 * \param[in] d The double to insert
+				 */
+				void addDouble(const double d);
+
+				/**
+				 * Inserts a blob type eValue at the end of the eBottle,
+				 * making first a local copy of the memory
+				 * 
+				 * \param[in] q A pointer to the blob
+				 * \param[in] size The size of the blob in bytes
+				 */
+				void addBlob(const char * q, const unsigned int size);
+
+				/**
+				 * Inserts a blob type eValue at the end of the eBottle,
+				 * taking ownership of the memory instead of copying it 
+				 * (in arena mode it is copied to the arena and freed)
+				 * 
+				 * \param[in] q The blob, allocated with new[]
+				 * \param[in] size The size of the blob in bytes
+				 */
+				void addBlob(std::unique_ptr<char[]> q, const unsigned int size);
+
+				/**
+				 * Inserts a string eValue at the end of the eBottle
+				 * 
+				 * \param[in] s The string to insert
+				 */
+				void addString(const std::string& s);
+
+				/**
+				 * Inserts a string eValue at the end of the eBottle, 
+				 * taking the characters of \p s
+				 * 
+				 * \param[in] s The string to insert
+				 */
+				void addString(std::string&& s);
+
+				/**
+				 * Inserts a string eValue at the end of the eBottle
+				 * 
+				 * \param[in] s The string to insert
+				 */
+				void addString(const ConstString& s);
+
+				/**
+				 * Inserts a string eValue at the end of the eBottle,
+				 * making first a copy local memory
+				 * 
+				 * \param[in] s A pointer to the null terminated char array to insert
 				 */
 				void addString(const char * s);
 
+				/**
+				 * Inserts an integer array eValue at the end of the eBottle,
+				 * making first a local copy of the integers
+				 * 
+				 * \param[in] p A pointer to the first integer
+				 * \param[in] n The amount of integers in the array
+				 */
+				void addIntArray(const int * p, const unsigned int n);
+
+				/**
+				 * Inserts a double array eValue at the end of the eBottle,
+				 * making first a local copy of the doubles
+				 * 
+				 * \param[in] p A pointer to the first double
+				 * \param[in] n The amount of doubles in the array
+				 */
+				void addDoubleArray(const double * p, const unsigned int n);
+
+				/**
+				 * Inserts a double array eValue at the end of the eBottle,
+				 * converting the floats to doubles
+				 * 
+				 * \param[in] p A pointer to the first float
+				 * \param[in] n The amount of floats in the array
+				 */
+				void addDoubleArray(const float * p, const unsigned int n);
+
 				/**
 				 * Reserves the memory for inserting a list at the end of the eBottle
 				 * 
+				 * Nested lists are shared by the copies of an eBottle until 
+				 * one of them is modified, except the ones returned by this 
+				 * method and the others below, which may be modified through 
+				 * the reference at any time: copies always get their own.
+				 * 
 				 * \return A reference to the empty list inserted in the eBottle 
 				 */
 				eBottle & addList();
 
+				/**
+				 * Inserts a list at the end of the eBottle, taking the 
+				 * contents of \p b, which is left empty
+				 * 
+				 * \param[in] b The list to insert
+				 * \return A reference to the list inserted in the eBottle 
+				 */
+				eBottle & addList(eBottle && b);
+
 				/**
 				 * Reserves the memory for inserting a list at the end of the eBottle
 				 * 
@@ -515,6 +1430,15 @@ namespace yarp {
 				 */
 				void append(const eBottle & yb);
 
+				/**
+				 * Moves all the values inside a given eBottle to the end of the 
+				 * eBottle, leaving it empty. The eValues are moved, not copied,
+				 * unless one of the two eBottles is in arena mode.
+				 * 
+				 * \param[in] yb The eBottle whose eValues will be appended
+				 */
+				void append(eBottle && yb);
+
 				/**
 				 * Removes the eValue at a certain position
 				 * 
@@ -548,9 +1472,9 @@ namespace yarp {
 				 * Access to the eBottle contents
 				 * 
 				 * \param[in] i A position inside the eBottle
-				 * \return The eValue at the \p i position
+				 * \return A constant reference to the eValue at the \p i position
 				 */
-				eValue & operator[](const unsigned int i) const;
+				const eValue & operator[](const unsigned int i) const;
 
 				/**
 				 * Access to the eBottle contents
@@ -564,9 +1488,32 @@ namespace yarp {
 				 * Access to the eBottle contents
 				 * 
 				 * \param[in] i A position inside the eBottle
-				 * \return The eValue at the \p i position
+				 * \return A constant reference to the eValue at the \p i position
+				 */
+				const eValue & get(const unsigned int i) const;
+
+				/**
+				 * Access to the eBottle contents as a C++ type, which must 
+				 * match the type of the eValue as in the eValue::as methods
+				 * 
+				 * \param[in] i A position inside the eBottle
+				 * \return The value at the \p i position
+				 * \throw std::out_of_range If there is no such position
+				 */
+				template <class T> typename eTypeTraits<T>::type get(const unsigned int i) const {
+					return eTypeTraits<T>::get(*values.at(i));
+				}
+
+				/**
+				 * Access to the eBottle contents as a C++ type, without 
+				 * checking the position, see get
+				 * 
+				 * \param[in] i A position inside the eBottle, less than size()
+				 * \return The value at the \p i position
 				 */
-				eValue & get(const unsigned int i) const;
+				template <class T> typename eTypeTraits<T>::type get_unchecked(const unsigned int i) const {
+					return eTypeTraits<T>::get(*values[i]);
+				}
 
 				/**
 				 * Access to the eBottle contents
@@ -574,7 +1521,7 @@ namespace yarp {
 				 * \param[in] i A position inside the eBottle
 				 * \return A constant pointer to the eValue at the \p i position
 				 */
-				eValue * getPtr(const unsigned int i) const;
+				const eValue * getPtr(const unsigned int i) const;
 
 				/**
 				 * Access to the eBottle contents
@@ -584,46 +1531,175 @@ namespace yarp {
 				 */
 				eValue * getPtr(const unsigned int i);
 
+				/**
+				 * Looks up the value of a key, as yarp::os::Bottle::find does
+				 * 
+				 * The eBottle is searched, in order, for a string equal to 
+				 * \p key followed by a value ("key value" pairs) or a list 
+				 * whose first value is the string ("(key value)" groups). 
+				 * The first match wins.
+				 * 
+				 * From INDEX_THRESHOLD values on, the first lookup builds a 
+				 * hash index of the keys, which is used until the eBottle or 
+				 * one of its lists changes. Lookups may run in several threads 
+				 * at once, as long as none of them changes the eBottle.
+				 * 
+				 * Unlike yarp::os::Bottle::find, which returns a Value& that 
+				 * is a null Value when the key is missing, this returns a 
+				 * pointer, as eBottle has no null eValue to refer to: code 
+				 * ported from Bottle tests it against NULL instead of 
+				 * calling isNull().
+				 * 
+				 * \param[in] key The key to look for
+				 * \return The value following the key, NULL if there is none
+				 */
+				const eValue * find(const char * key) const;
+
+				/**
+				 * Checks whether a key has a value, see find
+				 * 
+				 * \param[in] key The key to look for
+				 * \return True if find gives a value
+				 */
+				bool check(const char * key) const;
+
+				/**
+				 * Looks up the list that starts with a key, as 
+				 * yarp::os::Bottle::findGroup does, see find
+				 * 
+				 * Bottle::findGroup returns a Bottle& that is empty when the 
+				 * key is missing; this returns a pointer, NULL then.
+				 * 
+				 * \param[in] key The key to look for
+				 * \return The first list whose first value is \p key, 
+				 * including it, or NULL if there is none
+				 */
+				const eBottle * findGroup(const char * key) const;
+
+				/**
+				 * Looks up the value of a key in nested groups
+				 * 
+				 * Every key of a dotted path but the last one names a group 
+				 * inside the previous one, and the last one is looked up with 
+				 * find, so "arm.pid.kp" finds 0.5 in 
+				 * "(arm (pid (kp 0.5) (ki 0.1)))".
+				 * 
+				 * \param[in] path The keys separated by dots
+				 * \return The value, or NULL if some key is missing
+				 */
+				const eValue * findPath(const char * path) const;
+
 				/**
 				 * Builds a string that represents all the contents of the eBottle
 				 * 
+				 * Empty eValues, such as the ones left by moving a value out 
+				 * of the eBottle, are written as nothing and not read back by 
+				 * fromString().
+				 * 
 				 * \return The string representing the eBottle
 				 */
 				std::string toString() const;
 
+				/**
+				 * Writes the string that represents the eBottle into \p s
+				 * 
+				 * The previous contents of \p s are replaced, and its 
+				 * capacity is reused, so that rendering every message into 
+				 * the same string does not allocate.
+				 * 
+				 * \param[out] s The string representing the eBottle
+				 */
+				void toString(std::string & s) const;
+
+				/**
+				 * Writes the string that represents the eBottle to a file
+				 * 
+				 * \param[in] f The file to write to
+				 * \return False if the write failed
+				 */
+				bool print(FILE * f) const;
+
 				/**
 				 * Builds an eBottle from its string representation
 				 * 
+				 * The values are appended to the eBottle. Integers and 
+				 * doubles may be signed and use exponents, 0x prefixes 
+				 * hexadecimal integers, and +inf, -inf and +nan are doubles 
+				 * while inf and nan are strings. Strings with spaces are 
+				 * quoted and may use the escapes \\" \\\\ \\n \\t and \\r. 
+				 * Blobs are written {1 2 3} or {0x010203}, arrays [i 1 2] and 
+				 * [d 0.5 1]. Parsing keeps no state outside the eBottle, so 
+				 * several threads may parse at once.
+				 * 
+				 * Malformed text is still parsed as far as it goes, dropping 
+				 * the bytes and array numbers that are not valid, e.g. an odd 
+				 * amount of hex digits or a number out of the range of a byte.
+				 * 
 				 * \param[in] s A pointer to a null terminated char array 
 				 * representing an eBottle
+				 * \return False if the text is malformed: invalid bytes or 
+				 * array numbers, closers without an opener, lists, blobs, 
+				 * arrays or strings left open, or lists nested deeper than 
+				 * MAX_DEPTH
 				 */
-				void fromString(const char * s);
+				bool fromString(const char * s);
 
 				/**
 				 * Builds an eBottle from its string representation
 				 * 
 				 * \param[in] s The string representing the eBottle
+				 * \return False if the text is malformed
 				 */
-				void fromString(const std::string& s);
+				bool fromString(const std::string& s);
 
 				/**
 				 * Builds an eBottle from its string representation
 				 * 
 				 * \param[in] s The string representing the eBottle
+				 * \return False if the text is malformed
 				 */
-				void fromString(const ConstString& s);
+				bool fromString(const ConstString& s);
 
 				/**
 				 * Builds an eBottle from its binary representation
 				 * 
+				 * Both the current layout and the legacy one, without header 
+				 * and in host byte order, are accepted.
+				 * 
+				 * The representation is checked (see validate) before 
+				 * anything is decoded, so a corrupt one leaves the eBottle 
+				 * unchanged.
+				 * 
+				 * \param[in] p A pointer to the byte array with the binary representation
+				 * \param[in] size The size of the binary representation in bytes
+				 * \return True if the representation was valid and decoded
+				 */
+				bool fromBinary(const char * p, const int size);
+
+				/**
+				 * Checks a binary representation
+				 * 
+				 * A single linear pass over the counts, sizes and type tags,
+				 * without looking at the payloads, makes sure decoding the 
+				 * representation stays inside the buffer: every type is known, 
+				 * every size fits, strings are null terminated, lists are 
+				 * nested at most eBottle::MAX_DEPTH levels and the buffer has 
+				 * no bytes left over.
+				 * 
 				 * \param[in] p A pointer to the byte array with the binary representation
 				 * \param[in] size The size of the binary representation in bytes
+				 * \return True if the representation can be decoded safely
 				 */
-				void fromBinary(const char * p, const int size);
+				static bool validate(const char * p, const int size);
 
 				/**
 				 * Creates a binary representation of the eBottle
 				 * 
+				 * The representation starts with a magic number and a version, 
+				 * and every value in it starts at a multiple of 8 bytes, so 
+				 * doubles and arrays can be read in place (see eBottleView). 
+				 * Numbers are little-endian unless setBigEndian is used.
+				 * 
 				 * \param[out] size The size of the binary representation in bytes
 				 * \return A constant pointer owned by the eBottle to the binary representation
 				 */
@@ -636,13 +1712,27 @@ namespace yarp {
 				 * caller which is big enough to receive a copy of the binary 
 				 * representation of the eBottle. The size of the binary 
 				 * representation can be computed using eBottle::getBinarySize method.
-				 *				   				 
+				 * \return The size of the binary representation in bytes, which 
+				 * is less than getBinarySize() when payloads are compressed, or 
+				 * -1 if the eBottle grew past getBinarySize() through a string 
+				 * pointer or an eValue given by a const accessor (see 
+				 * getBinarySize). The buffer may have been partly written 
+				 * then, and getBinarySize() gives the right size again.
 				 */
-				void toBinary(char * p) const;
+				int toBinary(char * p) const;
 
 				/**
 				 * Computes the size of the binary representation of the eBottle
 				 * 
+				 * The size is kept up to date as eValues are added, inserted or 
+				 * removed, and as the eValues given by the non-const accessors 
+				 * are assigned, so this is O(1), and toBinary() and write() 
+				 * use it to write the message in a single pass. Strings given 
+				 * by eValue::asStringPtr may change size at any time: taking 
+				 * one makes the next call recompute the size of its list, and 
+				 * the eBottle is measured before being sent from then on, 
+				 * until it is cleared.
+				 * 
 				 * \return The size in bytes of the binary representation of th eBottle.
 				 * 
 				 * \sa toBinary
@@ -652,30 +1742,680 @@ namespace yarp {
 				/**
 				 * This function is inherited from <a href='http://eris.liralab.it/yarp/specs/dox/user/html/d4/d41/classyarp_1_1os_1_1Portable.html'>Portable interface</a>
 				 * and is used in data transmission.
+				 * 
+				 * The bytes are received in a buffer owned by the eBottle that 
+				 * only grows, and the eValues already in the eBottle are 
+				 * overwritten in place when the incoming message has the same 
+				 * shape, so receiving a stream of similar messages does not 
+				 * allocate memory.
+				 * 
+				 * Messages are checked (see validate) before being decoded. 
+				 * An invalid one clears the eBottle and returns false.
+				 * 
+				 * Messages bigger than eBottle::STREAM_CHUNK bytes are instead 
+				 * received in chunks of that size and decoded while they arrive 
+				 * (see eBottleDecoder), keeping only the bytes not decoded yet: 
+				 * about a chunk plus the biggest value of the message. An 
+				 * invalid one is still read to its end. To use the values 
+				 * while the rest arrives, feed an eBottleDecoder instead.
 				 */
 				virtual bool read(ConnectionReader& connection);
 
 				/**
 				 * This function is inherited from <a href='http://eris.liralab.it/yarp/specs/dox/user/html/d4/d41/classyarp_1_1os_1_1Portable.html'>Portable interface</a>
 				 * and is used in data transmission.
+				 * 
+				 * The message is not staged in a temporary buffer: the small 
+				 * fields are gathered in a scratch area on the stack, and blobs 
+				 * and strings of eBottle::EXTERNAL_BLOCK bytes or more are 
+				 * appended as external blocks pointing to the eValues, so they 
+				 * must not change until the connection has sent them.
 				 */
 				virtual bool write(ConnectionWriter& connection);
 
+				/**
+				 * \brief View mode
+				 * 
+				 * When enabled, read() does not build any eValue: the received 
+				 * bytes are kept in a buffer owned by the eBottle, which only 
+				 * grows, and can be inspected with view().
+				 * 
+				 * \param[in] enable True to keep the received bytes instead of 
+				 * decoding them
+				 */
+				void setViewMode(const bool enable);
+
+				/**
+				 * Checks whether the eBottle is in view mode
+				 * 
+				 * \return True if read() keeps the bytes instead of decoding them
+				 */
+				bool isViewMode() const;
+
+				/**
+				 * Access to the last message received in view mode
+				 * 
+				 * \return A view of the received bytes, valid until the next 
+				 * read() or the destruction of the eBottle
+				 */
+				eBottleView view() const;
+
+				/**
+				 * \brief Wire byte order
+				 * 
+				 * Numbers are written little-endian unless this is enabled. 
+				 * The byte order is recorded in the message header, so 
+				 * readers decode both.
+				 * 
+				 * \param[in] enable True to write numbers big-endian
+				 */
+				void setBigEndian(const bool enable);
+
+				/**
+				 * Checks whether the eBottle writes numbers big-endian
+				 * 
+				 * \return True if the wire byte order is big-endian
+				 */
+				bool isBigEndian() const;
+
+				/**
+				 * \brief Payload compression
+				 * 
+				 * When enabled, toBinary() and write() compress the blobs and 
+				 * strings, nested ones included, of at least \p threshold 
+				 * bytes with a fast LZ codec (see eCompress.h), and send the 
+				 * rest verbatim. Payloads that do not shrink are sent verbatim 
+				 * too. Compressed payloads are marked in the message and 
+				 * decompressed by every reader transparently, whatever their 
+				 * own setting.
+				 * 
+				 * It pays off on links slower than the codec, several hundred 
+				 * MB/s on typical sensor data (see "make bench"). 
+				 * getBinarySize() is then an upper bound of the size of the 
+				 * message.
+				 * 
+				 * \param[in] threshold The smallest payload compressed, in 
+				 * bytes, or 0 to disable compression
+				 */
+				void setCompression(const unsigned int threshold=COMPRESSION_THRESHOLD);
+
+				/**
+				 * Access to the compression threshold
+				 * 
+				 * \return The smallest payload compressed in bytes, or 0 if 
+				 * compression is disabled
+				 */
+				unsigned int getCompression() const;
+
+				/**
+				 * \brief Parallel coding
+				 * 
+				 * When enabled, messages of at least \p threshold bytes are 
+				 * coded on a pool of threads shared by all eBottles. To write 
+				 * one, the sizes of the nested lists are computed first and 
+				 * then runs of values, or of the values of big nested lists, 
+				 * are written to their own ranges of the message at the same 
+				 * time. To read one, its top level values are decoded at the 
+				 * same time, after checking the message as usual; such 
+				 * messages are received whole instead of decoded as they 
+				 * arrive.
+				 * 
+				 * The message is the same as the one written by a single 
+				 * thread. Writing is not parallel when compression is 
+				 * enabled, and neither writing nor reading are when the 
+				 * eBottle is in arena mode. Nothing changes while the pool 
+				 * has a single thread.
+				 * 
+				 * The pool codes one message at a time. A message that comes 
+				 * while another one is being coded, by another eBottle or 
+				 * thread, is coded by its own thread alone rather than 
+				 * waiting, so several threads writing big messages at once 
+				 * get no speedup from the pool, but never block on it.
+				 * 
+				 * \param[in] threshold The smallest message coded in 
+				 * parallel, in bytes, or 0 to disable parallel coding
+				 */
+				void setParallel(const unsigned int threshold=PARALLEL_THRESHOLD);
+
+				/**
+				 * Access to the parallel coding threshold
+				 * 
+				 * \return The smallest message coded in parallel in bytes, 
+				 * or 0 if parallel coding is disabled
+				 */
+				unsigned int getParallel() const;
+
+				/**
+				 * Sets the size of the pool of threads of parallel coding
+				 * 
+				 * Waits for the messages being coded in parallel. The pool 
+				 * starts with one thread per processor.
+				 * 
+				 * \param[in] n The amount of threads coding a message, the 
+				 * calling one included, or 0 for one per processor
+				 */
+				static void setThreads(const unsigned int n);
+
+				/**
+				 * Access to the size of the pool of threads of parallel coding
+				 * 
+				 * \return The amount of threads coding a message, the 
+				 * calling one included
+				 */
+				static unsigned int getThreads();
+
 			protected:
-				std::vector< eValue *> values;
-				unsigned int global_size;
+				struct Cursor;
+				struct TextWriter;
+				struct Packing;
+				struct Delta;
+				struct Part;
+
+				std::vector< eValue *, eArenaAllocator<eValue *> > values;
+				// size of the binary representation, valid when not dirty
+				mutable unsigned int global_size;
+				mutable bool dirty;
+				// the eBottle holding this one as a nested list
+				eBottle * parent;
+				// eValues holding this eBottle as a nested list
+				std::atomic<int> refs;
+				// this eBottle or one of its lists was handed out to be 
+				// modified in place, so it is never shared by copies
+				bool exposed;
+				// counts the changes to this eBottle or its lists, which all 
+				// go through changing()
+				unsigned int revision;
+				// strings of this eBottle or its lists were handed out as 
+				// pointers, so the size is measured before sending
+				bool loose;
 				mutable char * toBinaryPointer;
+				eArena * arena;
+				bool ownArena;
+				char * rxBuffer;
+				unsigned int rxCapacity;
+				int rxSize;
+				// decoder of the big messages, kept for its buffers
+				eBottleDecoder * rxDecoder;
+				bool viewMode;
+				bool bigEndian;
+				// offsets of the top level values received
+				std::vector<int> rxOffsets;
+				// smallest payload compressed when sending, 0 for none
+				unsigned int compression;
+				// compressed payloads of the message being sent, in order
+				mutable std::vector<char> packed;
+				// size of each compressed payload, 0 for the ones sent as they are
+				mutable std::vector<unsigned int> packedSizes;
+				// hash table of the positions of the keys, and the revision 
+				// it was built at plus one, 0 when not built
+				mutable std::vector<int> keyIndex;
+				mutable std::atomic<unsigned int> indexed;
+				// smallest message coded in parallel, 0 for none
+				unsigned int parallel;
+
+				// nested list living in the arena of its parent
+				eBottle(eArena * a);
+				void init(eArena * a);
+				void * allocValue();
+				void freeValue(eValue * v);
+				void destroyValues();
+				void adopt(eValue * v);
+				eValue * addBlock(const unsigned char type, const char * q, const unsigned int size);
+				void grow(const int delta);
+				void touch();
+				void changing();
+				void expose();
+				unsigned int measure() const;
+				unsigned int expectedSize() const;
+				int encode(char * p, const unsigned int room) const;
+				void loosen();
+				eBottle * newList();
+				void dropIndexes();
+				int locate(const char * key, const size_t n, const bool group) const;
+				void buildIndex() const;
+				static const std::string * keyOf(const eBottle * b, const int code);
+				static unsigned int binaryLength(const eValue * v);
+				static unsigned int payloadSize(const eValue * v);
+				static void flatten(eBottle * b, std::vector<eValue *> & leaves, std::vector<unsigned int> & shape);
+				static bool diff(const eBottle * b, Delta & d);
+				static void own(eBottle * b);
+				static char * leafData(eValue * v, unsigned int & bytes);
+				static void patch(eValue * v, const char * p, const bool swap);
 
 				// private methods
-				void fillString(std::ostringstream * s, const eBottle *b) const;
-				void fill(const eBottle * b, int &s, char * p = NULL) const;
-				void reconstruct(eBottle * b, int & s, char * p) const;
-				void fromStr(eBottle *b, const char * s2) const;
+				void fillString(TextWriter & w, const eBottle * b) const;
+				static bool validate(const char * p, const int size, std::vector<int> * offsets);
+				int header(char * p) const;
+				void fill(const eBottle * b, int &s, char * p, const bool swap, Packing & k) const;
+				void fillValues(const eBottle * b, const unsigned int first, const unsigned int last, int &s, char * p, const bool swap, Packing & k) const;
+				static unsigned int fillRun(const eBottle * b, const unsigned int first, const unsigned int last, int &s, char * p, const bool swap, const unsigned int end);
+				void fill(const eBottle * b, ConnectionWriter& c, char * scratch, int & used, const bool swap, Packing & k) const;
+				unsigned int pack(const eBottle * b) const;
+				unsigned int packedSize(const eValue * v, Packing & k) const;
+				void reconstruct(eBottle * b, Cursor & c) const;
+				void reconstructValue(eBottle * b, Cursor & c) const;
+				static unsigned int reconstructRun(eBottle * b, Cursor & c, const unsigned int left);
+				void update(eBottle * b, Cursor & c) const;
+				static bool overwrite(eValue * v, Cursor & c);
+				static void replace(eBottle * b, const unsigned int i);
+				bool stream(ConnectionReader& connection, const int size);
+				void load(const char * p, const int size, const std::vector<int> * offsets=NULL);
+				bool isParallel(const unsigned int size) const;
+				bool fillParallel(int & s, char * p, const bool swap, Packing & k) const;
+				void plan(const eBottle * b, int & s, char * p, const bool swap, const unsigned int grain, std::vector<Part> & parts, Packing & k) const;
+				void decodeParallel(const char * p, const int size, const std::vector<int> & offsets, const bool reuse);
+				const char * fromStr(eBottle * b, const char * p, const int depth, bool & ok) const;
 
 				// for debug only 
 				std::string content() const;
+
+				friend class eValue;
+				friend class eBottleView;
+				friend class eBottleDecoder;
+				friend class eBottleDeltaWriter;
+				friend class eBottleDeltaReader;
+				friend class eShmReader;
+				template <class T> friend struct eTypeTraits;
+		};
+
+		/*
+		 * Inline definitions, so that the typed accessors of eBottle 
+		 * compile to a few instructions for numbers
+		 */
+		inline eValue::eValue(const int i) {
+			value.i=i;
+			type=INT;
+			flags=0;
+			size=sizeof(int);
+			owner=NULL;
+		}
+
+		inline eValue::eValue(const double d) {
+			value.d=d;
+			type=DOUBLE;
+			flags=0;
+			size=sizeof(double);
+			owner=NULL;
+		}
+
+		inline eValue::ValueType eValue::getType() const {
+			return (ValueType) type;
+		}
+
+		inline int eValue::asInt() const {
+			return value.i;
+		}
+
+		inline double eValue::asDouble() const {
+			return value.d;
+		}
+
+		inline void * eBottle::allocValue() {
+			if (arena!=NULL) {
+				return arena->allocate(sizeof(eValue));
+			}
+			return ePool::allocate(sizeof(eValue));
+		}
+
+		inline void eBottle::changing() {
+			// only lists that are not shared are written, so a change just 
+			// moves the revisions up to the top
+			for (eBottle * b=this; b!=NULL; b=b->parent) {
+				b->revision++;
+			}
+		}
+
+		inline void eValue::changing() {
+			if (owner!=NULL) {
+				owner->changing();
+			}
+		}
+
+		inline void eBottle::grow(const int delta) {
+			// a dirty eBottle has dirty ancestors, so nothing above needs it
+			for (eBottle * b=this; b!=NULL && !b->dirty; b=b->parent) {
+				b->global_size+=delta;
+			}
+		}
+
+		/*
+		 * Each append adds a value and gives the bytes that the binary 
+		 * representation still has to grow, which the ones going through 
+		 * the usual add methods have already done.
+		 */
+		template <> struct eTypeTraits<int> {
+			static const bool value = true;
+			typedef int type;
+			static unsigned int append(eBottle & b, const int v) {
+				b.values.push_back(new (b.allocValue()) eValue(v));
+				return 2*sizeof(int);
+			}
+			static int get(const eValue & v) {
+				return v.asInt();
+			}
+		};
+
+		template <> struct eTypeTraits<double> {
+			static const bool value = true;
+			typedef double type;
+			static unsigned int append(eBottle & b, const double v) {
+				b.values.push_back(new (b.allocValue()) eValue(v));
+				return 2*sizeof(double);
+			}
+			static double get(const eValue & v) {
+				return v.asDouble();
+			}
+		};
+
+		template <> struct eTypeTraits<const char *> {
+			static const bool value = true;
+			typedef const char * type;
+			static unsigned int append(eBottle & b, const char * v) {
+				b.addString(v);
+				return 0;
+			}
+			static const char * get(const eValue & v) {
+				return v.str()->c_str();
+			}
+		};
+
+		template <> struct eTypeTraits<char *> : public eTypeTraits<const char *> {
+		};
+
+		template <> struct eTypeTraits<std::string> {
+			static const bool value = true;
+			typedef std::string type;
+			static unsigned int append(eBottle & b, const std::string & v) {
+				b.addString(v);
+				return 0;
+			}
+			static std::string get(const eValue & v) {
+				return *v.str();
+			}
+		};
+
+		template <> struct eTypeTraits<const eBottle *> {
+			static const bool value = true;
+			typedef const eBottle * type;
+			static unsigned int append(eBottle & b, const eBottle * v) {
+				*b.newList()=*v;
+				return 0;
+			}
+			static const eBottle * get(const eValue & v) {
+				return v.asList();
+			}
+		};
+
+		template <> struct eTypeTraits<eBottle *> : public eTypeTraits<const eBottle *> {
+		};
+
+		template <> struct eTypeTraits< std::vector<int> > {
+			static const bool value = true;
+			typedef std::vector<int> type;
+			static unsigned int append(eBottle & b, const std::vector<int> & v) {
+				b.addIntArray(v.data(), v.size());
+				return 0;
+			}
+			static std::vector<int> get(const eValue & v) {
+				return std::vector<int>(v.asIntArray(), v.asIntArray()+v.asArrayLength());
+			}
+		};
+
+		template <> struct eTypeTraits< std::vector<double> > {
+			static const bool value = true;
+			typedef std::vector<double> type;
+			static unsigned int append(eBottle & b, const std::vector<double> & v) {
+				b.addDoubleArray(v.data(), v.size());
+				return 0;
+			}
+			static std::vector<double> get(const eValue & v) {
+				return std::vector<double>(v.asDoubleArray(), v.asDoubleArray()+v.asArrayLength());
+			}
+		};
+
+		/**
+		 * \brief Incremental decoder of eBottle binary representations
+		 * 
+		 * Builds an eBottle from a message that arrives in chunks, while 
+		 * it arrives. The decoder keeps its position between chunks and 
+		 * adds every value to the target eBottle as soon as its bytes are 
+		 * there, so decoding overlaps with the transfer instead of starting 
+		 * after it. eBottle::read uses it for big messages.
+		 * 
+		 * Completed values are delivered by polling: after each call to 
+		 * feed() or receive(), the first decoded() values of the target 
+		 * are complete and do not change until the message is, so they 
+		 * can be used right away. The value after them may be a nested 
+		 * list still being filled, and the ones after that still hold the 
+		 * previous contents. The message is checked as it is decoded, with 
+		 * the same rules as eBottle::validate. Messages in the legacy 
+		 * layout are decoded when their last byte arrives.
+		 */
+		class eBottleDecoder {
+			public:
+				/**
+				 * Decoding state
+				 */
+				enum Status { MORE=0, DONE, FAILED };
+
+				/**
+				 * \brief Target constructor
+				 * 
+				 * \param[in] target The eBottle to build, which must outlive 
+				 * the decoder
+				 */
+				explicit eBottleDecoder(eBottle & target);
+
+				/**
+				 * Starts decoding a message
+				 * 
+				 * As in eBottle::read, the eValues already in the target are 
+				 * overwritten in place where the message has the same shape, 
+				 * and the ones left over are dropped when the message is 
+				 * complete. Past decoded(), the target still holds values of 
+				 * its previous contents.
+				 * 
+				 * \param[in] size The size of the message in bytes
+				 * \param[in] buffer Where the chunks are gathered, of at least 
+				 * \p size bytes and outliving the decoding, or NULL to use a 
+				 * buffer owned by the decoder, which only keeps the bytes of 
+				 * the value being decoded and the ones after it
+				 */
+				void begin(const int size, char * buffer=NULL);
+
+				/**
+				 * Decodes a chunk of the message
+				 * 
+				 * \param[in] p A pointer to the next bytes of the message
+				 * \param[in] n The amount of bytes, which are copied
+				 * \return MORE until the message is complete, then DONE, or 
+				 * FAILED if it is invalid or longer than announced, which 
+				 * clears the target
+				 */
+				Status feed(const char * p, const int n);
+
+				/**
+				 * Reads a chunk of the message from a connection and decodes it
+				 * 
+				 * \param[in] connection The connection to read from
+				 * \param[in] n The amount of bytes to read, at most what is 
+				 * left of the message
+				 * \return As feed()
+				 */
+				Status receive(ConnectionReader& connection, const int n);
+
+				/**
+				 * Access to the decoding state
+				 * 
+				 * \return MORE, DONE or FAILED
+				 */
+				Status status() const;
+
+				/**
+				 * Access to the decoding progress
+				 * 
+				 * \return The amount of complete top level values in the target
+				 */
+				unsigned int decoded() const;
+
+				/**
+				 * Access to the decoding progress
+				 * 
+				 * \return The amount of bytes of the message still to come
+				 */
+				int remaining() const;
+
+			private:
+				// a list being filled, with the amount of values still to come
+				struct Frame {
+					eBottle * list;
+					// values in the message, and decoded so far
+					unsigned int n;
+					unsigned int i;
+					// offset of the first value
+					int start;
+				};
+
+				Status decode();
+				Status fail();
+				void reserve(const int n);
+				void open(eBottle * list, const unsigned int n, const int start);
+				void close(const Frame & f);
+
+				eBottle & target;
+				std::vector<char> own;
+				char * buffer;
+				// whether the buffer is own, which drops the decoded bytes, 
+				// and the offset in the message of its first byte
+				bool sliding;
+				int base;
+				int size;
+				int received;
+				// offset of the next value, 0 before the header is decoded
+				int pos;
+				std::vector<Frame> stack;
+				unsigned int done;
+				bool swap;
+				// whether compressed payloads were decoded
+				bool packed;
+				Status state;
+		};
+
+
+		/**
+		 * \brief Sends an eBottle as differences with the previous message
+		 * 
+		 * For streams whose messages keep the same shape (types, sizes of 
+		 * blobs, strings and arrays, and lists) while a few values change. 
+		 * The writer keeps the payloads last sent and, while the shape 
+		 * stays the same, sends only a bitmap of the values that changed 
+		 * and their new payloads. When the shape changes, and every 
+		 * keyframe interval, it sends the whole eBottle instead.
+		 * 
+		 * It is used as the eBottle would, e.g. with Port::write, and must 
+		 * be read by an eBottleDeltaReader. The messages carry a sequence 
+		 * number, so a reader that misses one ignores the stream until the 
+		 * next keyframe.
+		 */
+		class eBottleDeltaWriter : public yarp::os::PortWriter {
+			public:
+				/**
+				 * \brief Source constructor
+				 * 
+				 * \param[in] source The eBottle to send, which must outlive 
+				 * the writer
+				 * \param[in] keyframes Amount of messages between keyframes, 
+				 * 0 for keyframes only when the shape changes
+				 */
+				explicit eBottleDeltaWriter(eBottle & source, const unsigned int keyframes=100);
+
+				/**
+				 * Sends the source, as a keyframe or as its differences with 
+				 * the previous message
+				 */
+				virtual bool write(ConnectionWriter& connection);
+
+				/**
+				 * Makes the next message a keyframe, e.g. when a reader connects
+				 */
+				void requestKeyframe();
+
+				/**
+				 * Access to the kind of the last message
+				 * 
+				 * \return True if the last message written was a keyframe
+				 */
+				bool wasKeyframe() const;
+
+			private:
+				eBottle & source;
+				unsigned int keyframes;
+				// messages since the last keyframe
+				unsigned int sinceKeyframe;
+				uint32_t sequence;
+				bool keyframe;
+				bool forceKeyframe;
+				// shape of the last message, and its values with a payload
+				std::vector<unsigned int> shape;
+				uint32_t hash;
+				std::vector<eValue *> leaves;
+				// payloads last sent, one after the other
+				std::vector<char> image;
+				std::vector<char> message;
 		};
 
+		/**
+		 * \brief Receives the messages of an eBottleDeltaWriter
+		 * 
+		 * Keyframes are decoded like eBottle::read does, and the differences 
+		 * are applied in place to the eValues of the target, so only the 
+		 * values that changed are decoded.
+		 */
+		class eBottleDeltaReader : public yarp::os::PortReader {
+			public:
+				/**
+				 * \brief Target constructor
+				 * 
+				 * \param[in] target The eBottle to keep up to date, which must 
+				 * outlive the reader. Copies of it are not changed by the 
+				 * messages that follow. If it is changed between messages 
+				 * so that its shape differs from the last keyframe, the 
+				 * messages are refused until the next one.
+				 */
+				explicit eBottleDeltaReader(eBottle & target);
+
+				/**
+				 * Applies a message to the target
+				 * 
+				 * \return False if the message is invalid or does not follow 
+				 * the last one applied, in which case the target is left as 
+				 * it was
+				 */
+				virtual bool read(ConnectionReader& connection);
+
+				/**
+				 * Checks whether the target follows the stream
+				 * 
+				 * \return True once a keyframe has been applied, until a 
+				 * message is missed
+				 */
+				bool isSynchronized() const;
+
+			private:
+				bool apply(const char * p, const int size, const bool swap);
+
+				eBottle & target;
+				bool synchronized;
+				uint32_t sequence;
+				uint32_t hash;
+				// shape of the last keyframe, and of the target when patched
+				std::vector<unsigned int> shape;
+				std::vector<unsigned int> current;
+				// values with a payload, found at this revision of the target
+				std::vector<eValue *> leaves;
+				unsigned int revision;
+				std::vector<char> buffer;
+		};
 	}
 }
 
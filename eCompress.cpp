@@ -0,0 +1,265 @@
+/*------------------------------------------------------------------------
+ *  Copyright (C) 2000-2008, Universidad de Zaragoza, SPAIN
+ *
+ *  Contact Addresses: Danilo Tardioli                   dantard@unizar.es
+ *
+ *  eBottle is free software;  you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation;  either version 2, or (at your option) any
+ *  later version.
+ *
+ *  eBottle is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  distributed with eBottle; see file COPYING. If not,  write to the
+ *  Free Software  Foundation, 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ *  As a special exception, if you link this unit with other files to
+ *  produce an executable, this unit does not by itself cause the resulting
+ *  executable to be covered by the GNU General Public License.  This
+ *  exception does not however invalidate any other reasons why the
+ *  executable file might be covered by the GNU Public License.
+ *
+ *-------------------------------------------------------------------------*/
+#include <yarp/os/eCompress.h>
+#include <cstring>
+#include <stdint.h>
+
+static const unsigned int MIN_MATCH=4;
+static const unsigned int MAX_OFFSET=65535;
+static const unsigned int HASH_BITS=12;
+// the last bytes are always literals, so matches can be read 8 at a time
+static const size_t TAIL=12;
+
+static inline uint32_t read32(const unsigned char * p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline unsigned int hash(const uint32_t v) {
+	return (v*2654435761u)>>(32-HASH_BITS);
+}
+
+// length of the common prefix of a and b, stopping at end
+static inline size_t common(const unsigned char * a, const unsigned char * b, const unsigned char * end) {
+	const unsigned char * start=b;
+	while (b+sizeof(uint64_t)<=end) {
+		uint64_t x, y;
+		memcpy(&x, a, sizeof(x));
+		memcpy(&y, b, sizeof(y));
+		if (x!=y) {
+			break;
+		}
+		a+=sizeof(x);
+		b+=sizeof(x);
+	}
+	while (b<end && *a==*b) {
+		a++;
+		b++;
+	}
+	return b-start;
+}
+
+// writes the bytes of a length past a nibble of 15
+static inline unsigned char * putLength(unsigned char * op, size_t n) {
+	while (n>=255) {
+		*op++=255;
+		n-=255;
+	}
+	*op++=(unsigned char) n;
+	return op;
+}
+
+static inline size_t lengthBytes(const size_t n) {
+	return (n<15) ? 0 : (n-15)/255+1;
+}
+
+size_t yarp::os::eCompress::compress(void * dst, const size_t capacity, const void * src, const size_t n) {
+	const unsigned char * ip=(const unsigned char *) src;
+	const unsigned char * const start=ip;
+	const unsigned char * const end=start+n;
+	const unsigned char * anchor=ip;
+	unsigned char * op=(unsigned char *) dst;
+	unsigned char * const limit=op+capacity;
+	if (n>TAIL) {
+		uint32_t table[1<<HASH_BITS];
+		memset(table, 0, sizeof(table));
+		const unsigned char * const matchEnd=end-TAIL;
+		ip++;
+		while (ip<matchEnd) {
+			// incompressible runs are skipped faster the longer they get
+			uint32_t v=read32(ip);
+			unsigned int h=hash(v);
+			const unsigned char * ref=start+table[h];
+			table[h]=(uint32_t) (ip-start);
+			if (ip-ref>(ptrdiff_t) MAX_OFFSET || read32(ref)!=v || ref>=ip) {
+				ip+=1+((ip-anchor)>>6);
+				continue;
+			}
+			// extend backwards over the pending literals
+			while (ip>anchor && ref>start && ip[-1]==ref[-1]) {
+				ip--;
+				ref--;
+			}
+			size_t literals=ip-anchor;
+			size_t match=MIN_MATCH+common(ref+MIN_MATCH, ip+MIN_MATCH, matchEnd);
+			size_t need=1+lengthBytes(literals)+literals+2+lengthBytes(match-MIN_MATCH);
+			if (op+need>limit) {
+				return 0;
+			}
+			unsigned char * token=op++;
+			*token=(unsigned char) (((literals<15) ? literals : 15)<<4);
+			if (literals>=15) {
+				op=putLength(op, literals-15);
+			}
+			memcpy(op, anchor, literals);
+			op+=literals;
+			unsigned int offset=(unsigned int) (ip-ref);
+			*op++=(unsigned char) offset;
+			*op++=(unsigned char) (offset>>8);
+			size_t m=match-MIN_MATCH;
+			*token|=(unsigned char) ((m<15) ? m : 15);
+			if (m>=15) {
+				op=putLength(op, m-15);
+			}
+			ip+=match;
+			anchor=ip;
+			if (ip<matchEnd) {
+				// the positions inside the match are not hashed, but this one is
+				table[hash(read32(ip-2))]=(uint32_t) (ip-2-start);
+			}
+		}
+	}
+	size_t literals=end-anchor;
+	if (op+1+lengthBytes(literals)+literals>limit) {
+		return 0;
+	}
+	*op++=(unsigned char) (((literals<15) ? literals : 15)<<4);
+	if (literals>=15) {
+		op=putLength(op, literals-15);
+	}
+	if (literals>0) {
+		memcpy(op, anchor, literals);
+		op+=literals;
+	}
+	return op-(unsigned char *) dst;
+}
+
+// reads the bytes of a length past a nibble of 15, false if they run out
+static inline bool getLength(const unsigned char * & ip, const unsigned char * end, size_t & n) {
+	unsigned char b;
+	do {
+		if (ip==end) {
+			return false;
+		}
+		b=*ip++;
+		n+=b;
+	} while (b==255);
+	return true;
+}
+
+bool yarp::os::eCompress::check(const void * src, const size_t n, const size_t size) {
+	const unsigned char * ip=(const unsigned char *) src;
+	const unsigned char * const end=ip+n;
+	size_t out=0;
+	while (ip<end) {
+		unsigned char token=*ip++;
+		size_t literals=token>>4;
+		if (literals==15 && !getLength(ip, end, literals)) {
+			return false;
+		}
+		if (literals>(size_t) (end-ip) || literals>size-out) {
+			return false;
+		}
+		ip+=literals;
+		out+=literals;
+		if (ip==end) {
+			break;
+		}
+		if (end-ip<2) {
+			return false;
+		}
+		size_t offset=ip[0] | (ip[1]<<8);
+		ip+=2;
+		size_t match=token & 15;
+		if (match==15 && !getLength(ip, end, match)) {
+			return false;
+		}
+		match+=MIN_MATCH;
+		if (offset==0 || offset>out || match>size-out) {
+			return false;
+		}
+		out+=match;
+	}
+	return out==size;
+}
+
+void yarp::os::eCompress::decompress(void * dst, const size_t size, const void * src, const size_t n) {
+	const unsigned char * ip=(const unsigned char *) src;
+	const unsigned char * const end=ip+n;
+	unsigned char * op=(unsigned char *) dst;
+	unsigned char * const oend=op+size;
+	while (ip<end) {
+		unsigned char token=*ip++;
+		size_t literals=token>>4;
+		if (literals==15) {
+			getLength(ip, end, literals);
+		}
+		if (literals<=16 && end-ip>=16 && oend-op>=16) {
+			// short runs are copied as a whole word pair, away from the ends
+			memcpy(op, ip, 16);
+		} else if (literals>0) {
+			memcpy(op, ip, literals);
+		}
+		ip+=literals;
+		op+=literals;
+		if (ip==end) {
+			break;
+		}
+		size_t offset=ip[0] | (ip[1]<<8);
+		ip+=2;
+		size_t match=token & 15;
+		if (match==15) {
+			getLength(ip, end, match);
+		}
+		match+=MIN_MATCH;
+		const unsigned char * ref=op-offset;
+		unsigned char * const stop=op+match;
+		if (offset>=sizeof(uint64_t) && oend-stop>=(ptrdiff_t) sizeof(uint64_t)) {
+			// each word comes from bytes already written, and may go past 
+			// the match as long as it stays inside the output
+			while (op<stop) {
+				memcpy(op, ref, sizeof(uint64_t));
+				op+=sizeof(uint64_t);
+				ref+=sizeof(uint64_t);
+			}
+		} else if (offset>=match) {
+			memcpy(op, ref, match);
+		} else if (oend-stop>=(ptrdiff_t) sizeof(uint64_t)) {
+			// a pattern shorter than a word: once a word of it is written, 
+			// it repeats at a multiple of its period that is a word or more
+			size_t period=(sizeof(uint64_t)+offset-1)/offset*offset;
+			for (size_t i=0; i<sizeof(uint64_t); i++) {
+				op[i]=ref[i];
+			}
+			op+=sizeof(uint64_t);
+			ref=op-period;
+			while (op<stop) {
+				memcpy(op, ref, sizeof(uint64_t));
+				op+=sizeof(uint64_t);
+				ref+=sizeof(uint64_t);
+			}
+		} else {
+			// at the end of the output
+			for (size_t i=0; i<match; i++) {
+				op[i]=ref[i];
+			}
+		}
+		op=stop;
+	}
+}
@@ -0,0 +1,97 @@
+/*------------------------------------------------------------------------
+ *  Copyright (C) 2000-2008, Universidad de Zaragoza, SPAIN
+ *
+ *  Contact Addresses: Danilo Tardioli                   dantard@unizar.es
+ *
+ *  eBottle is free software;  you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation;  either version 2, or (at your option) any
+ *  later version.
+ *
+ *  eBottle is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  distributed with eBottle; see file COPYING. If not,  write to the
+ *  Free Software  Foundation, 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ *  As a special exception, if you link this unit with other files to
+ *  produce an executable, this unit does not by itself cause the resulting
+ *  executable to be covered by the GNU General Public License.  This
+ *  exception does not however invalidate any other reasons why the
+ *  executable file might be covered by the GNU Public License.
+ *
+ *-------------------------------------------------------------------------*/
+/** \file eCompress.h
+ * 
+ * \brief Fast LZ compression of blob and string payloads
+ * 
+ * A byte oriented LZ77 codec in the spirit of LZ4, tuned for speed over 
+ * ratio so that compressing a payload is cheaper than sending the bytes 
+ * it saves over a slow link. A compressed block is a sequence of
+ * 
+ *     token, [literal length], literals, offset, [match length]
+ * 
+ * where the high nibble of the token is the amount of literals and the 
+ * low one the match length minus 4; a nibble of 15 is followed by bytes 
+ * adding to it, while they are 255. The offset is two bytes, 
+ * little-endian, counted back from the current output position. The 
+ * last sequence ends after its literals.
+ */
+
+#ifndef ECOMPRESS_H_
+#define ECOMPRESS_H_
+
+#include <cstddef>
+
+namespace yarp {
+
+	namespace os {
+
+		/**
+		 * \brief LZ codec for payloads
+		 */
+		namespace eCompress {
+
+			/**
+			 * Compresses a block of memory
+			 * 
+			 * \param[out] dst The destination
+			 * \param[in] capacity The size of the destination in bytes
+			 * \param[in] src The bytes to compress
+			 * \param[in] n The amount of bytes to compress
+			 * \return The size of the compressed block, or 0 if it does not 
+			 * fit in \p capacity bytes
+			 */
+			size_t compress(void * dst, const size_t capacity, const void * src, const size_t n);
+
+			/**
+			 * Checks that a compressed block is well formed
+			 * 
+			 * Only the structure is walked, so this is much cheaper than 
+			 * decompressing.
+			 * 
+			 * \param[in] src The compressed block
+			 * \param[in] n The size of the compressed block in bytes
+			 * \param[in] size The size the block must decompress to
+			 * \return True if decompress can be called on the block
+			 */
+			bool check(const void * src, const size_t n, const size_t size);
+
+			/**
+			 * Decompresses a block of memory that passed check
+			 * 
+			 * \param[out] dst The destination, of \p size bytes
+			 * \param[in] size The size of the decompressed block in bytes
+			 * \param[in] src The compressed block
+			 * \param[in] n The size of the compressed block in bytes
+			 */
+			void decompress(void * dst, const size_t size, const void * src, const size_t n);
+		}
+	}
+}
+
+#endif /*ECOMPRESS_H_*/
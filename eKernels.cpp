@@ -0,0 +1,388 @@
+/*------------------------------------------------------------------------
+ *  Copyright (C) 2000-2008, Universidad de Zaragoza, SPAIN
+ *
+ *  Contact Addresses: Danilo Tardioli                   dantard@unizar.es
+ *
+ *  eBottle is free software;  you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation;  either version 2, or (at your option) any
+ *  later version.
+ *
+ *  eBottle is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  distributed with eBottle; see file COPYING. If not,  write to the
+ *  Free Software  Foundation, 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ *  As a special exception, if you link this unit with other files to
+ *  produce an executable, this unit does not by itself cause the resulting
+ *  executable to be covered by the GNU General Public License.  This
+ *  exception does not however invalidate any other reasons why the
+ *  executable file might be covered by the GNU Public License.
+ *
+ *-------------------------------------------------------------------------*/
+
+#include <yarp/os/eKernels.h>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EKERNELS_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Scalar versions, also used for the tails of the vector ones. Every
+ * element goes through memcpy because nothing is aligned.
+ */
+static void bswap32Scalar(char * d, const char * s, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		uint32_t v;
+		memcpy(&v, s+4*i, 4);
+		v=yarp::os::eKernels::swap32(v);
+		memcpy(d+4*i, &v, 4);
+	}
+}
+
+static void bswap64Scalar(char * d, const char * s, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		uint64_t v;
+		memcpy(&v, s+8*i, 8);
+		v=yarp::os::eKernels::swap64(v);
+		memcpy(d+8*i, &v, 8);
+	}
+}
+
+static void narrowScalar(float * d, const char * s, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		double v;
+		memcpy(&v, s+8*i, 8);
+		d[i]=(float) v;
+	}
+}
+
+static void widenScalar(char * d, const float * s, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		double v=s[i];
+		memcpy(d+8*i, &v, 8);
+	}
+}
+
+static void interleave32Scalar(char * d, const uint32_t t, const char * s, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		memcpy(d+8*i, &t, 4);
+		memcpy(d+8*i+4, s+4*i, 4);
+	}
+}
+
+static void interleave64Scalar(char * d, const uint64_t t, const char * s, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		memcpy(d+16*i, &t, 8);
+		memcpy(d+16*i+8, s+8*i, 8);
+	}
+}
+
+static void deinterleave32Scalar(char * d, const char * s, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		memcpy(d+4*i, s+8*i+4, 4);
+	}
+}
+
+static void deinterleave64Scalar(char * d, const char * s, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		memcpy(d+8*i, s+16*i+8, 8);
+	}
+}
+
+#ifdef EKERNELS_X86
+
+/*
+ * SSE2 has no byte shuffle: bytes are swapped inside 16 bit words and 
+ * then the words are reordered.
+ */
+__attribute__((target("sse2")))
+static void bswap32Sse2(char * d, const char * s, size_t n) {
+	size_t i=0;
+	for (; i+4<=n; i+=4) {
+		__m128i v=_mm_loadu_si128((const __m128i *) (s+4*i));
+		v=_mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		v=_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		v=_mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		_mm_storeu_si128((__m128i *) (d+4*i), v);
+	}
+	bswap32Scalar(d+4*i, s+4*i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void bswap64Sse2(char * d, const char * s, size_t n) {
+	size_t i=0;
+	for (; i+2<=n; i+=2) {
+		__m128i v=_mm_loadu_si128((const __m128i *) (s+8*i));
+		v=_mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		v=_mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+		v=_mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+		_mm_storeu_si128((__m128i *) (d+8*i), v);
+	}
+	bswap64Scalar(d+8*i, s+8*i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void narrowSse2(float * d, const char * s, size_t n) {
+	size_t i=0;
+	for (; i+4<=n; i+=4) {
+		__m128 lo=_mm_cvtpd_ps(_mm_loadu_pd((const double *) (s+8*i)));
+		__m128 hi=_mm_cvtpd_ps(_mm_loadu_pd((const double *) (s+8*i+16)));
+		_mm_storeu_ps(d+i, _mm_movelh_ps(lo, hi));
+	}
+	narrowScalar(d+i, s+8*i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void widenSse2(char * d, const float * s, size_t n) {
+	size_t i=0;
+	for (; i+4<=n; i+=4) {
+		__m128 f=_mm_loadu_ps(s+i);
+		_mm_storeu_pd((double *) (d+8*i), _mm_cvtps_pd(f));
+		_mm_storeu_pd((double *) (d+8*i+16), _mm_cvtps_pd(_mm_movehl_ps(f, f)));
+	}
+	widenScalar(d+8*i, s+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void interleave32Sse2(char * d, const uint32_t t, const char * s, size_t n) {
+	const __m128i tags=_mm_set1_epi32(t);
+	size_t i=0;
+	for (; i+4<=n; i+=4) {
+		__m128i v=_mm_loadu_si128((const __m128i *) (s+4*i));
+		_mm_storeu_si128((__m128i *) (d+8*i), _mm_unpacklo_epi32(tags, v));
+		_mm_storeu_si128((__m128i *) (d+8*i+16), _mm_unpackhi_epi32(tags, v));
+	}
+	interleave32Scalar(d+8*i, t, s+4*i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void interleave64Sse2(char * d, const uint64_t t, const char * s, size_t n) {
+	const __m128i tags=_mm_set1_epi64x(t);
+	size_t i=0;
+	for (; i+2<=n; i+=2) {
+		__m128i v=_mm_loadu_si128((const __m128i *) (s+8*i));
+		_mm_storeu_si128((__m128i *) (d+16*i), _mm_unpacklo_epi64(tags, v));
+		_mm_storeu_si128((__m128i *) (d+16*i+16), _mm_unpackhi_epi64(tags, v));
+	}
+	interleave64Scalar(d+16*i, t, s+8*i, n-i);
+}
+
+// the odd words of two vectors, through the float shuffle
+__attribute__((target("sse2")))
+static void deinterleave32Sse2(char * d, const char * s, size_t n) {
+	size_t i=0;
+	for (; i+4<=n; i+=4) {
+		__m128 a=_mm_loadu_ps((const float *) (s+8*i));
+		__m128 b=_mm_loadu_ps((const float *) (s+8*i+16));
+		_mm_storeu_ps((float *) (d+4*i), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+	deinterleave32Scalar(d+4*i, s+8*i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void deinterleave64Sse2(char * d, const char * s, size_t n) {
+	size_t i=0;
+	for (; i+2<=n; i+=2) {
+		__m128i a=_mm_loadu_si128((const __m128i *) (s+16*i));
+		__m128i b=_mm_loadu_si128((const __m128i *) (s+16*i+16));
+		_mm_storeu_si128((__m128i *) (d+8*i), _mm_unpackhi_epi64(a, b));
+	}
+	deinterleave64Scalar(d+8*i, s+16*i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void bswap32Avx2(char * d, const char * s, size_t n) {
+	const __m256i mask=_mm256_setr_epi8(
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	size_t i=0;
+	for (; i+8<=n; i+=8) {
+		__m256i v=_mm256_loadu_si256((const __m256i *) (s+4*i));
+		_mm256_storeu_si256((__m256i *) (d+4*i), _mm256_shuffle_epi8(v, mask));
+	}
+	bswap32Scalar(d+4*i, s+4*i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void bswap64Avx2(char * d, const char * s, size_t n) {
+	const __m256i mask=_mm256_setr_epi8(
+			7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+			7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	size_t i=0;
+	for (; i+4<=n; i+=4) {
+		__m256i v=_mm256_loadu_si256((const __m256i *) (s+8*i));
+		_mm256_storeu_si256((__m256i *) (d+8*i), _mm256_shuffle_epi8(v, mask));
+	}
+	bswap64Scalar(d+8*i, s+8*i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void narrowAvx2(float * d, const char * s, size_t n) {
+	size_t i=0;
+	for (; i+8<=n; i+=8) {
+		__m128 lo=_mm256_cvtpd_ps(_mm256_loadu_pd((const double *) (s+8*i)));
+		__m128 hi=_mm256_cvtpd_ps(_mm256_loadu_pd((const double *) (s+8*i+32)));
+		_mm_storeu_ps(d+i, lo);
+		_mm_storeu_ps(d+i+4, hi);
+	}
+	narrowScalar(d+i, s+8*i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void widenAvx2(char * d, const float * s, size_t n) {
+	size_t i=0;
+	for (; i+8<=n; i+=8) {
+		_mm256_storeu_pd((double *) (d+8*i), _mm256_cvtps_pd(_mm_loadu_ps(s+i)));
+		_mm256_storeu_pd((double *) (d+8*i+32), _mm256_cvtps_pd(_mm_loadu_ps(s+i+4)));
+	}
+	widenScalar(d+8*i, s+i, n-i);
+}
+
+/*
+ * The AVX2 unpacks work inside each 128 bit lane, so the lanes are put 
+ * back in order afterwards.
+ */
+__attribute__((target("avx2")))
+static void interleave32Avx2(char * d, const uint32_t t, const char * s, size_t n) {
+	const __m256i tags=_mm256_set1_epi32(t);
+	size_t i=0;
+	for (; i+8<=n; i+=8) {
+		__m256i v=_mm256_loadu_si256((const __m256i *) (s+4*i));
+		__m256i lo=_mm256_unpacklo_epi32(tags, v);
+		__m256i hi=_mm256_unpackhi_epi32(tags, v);
+		_mm256_storeu_si256((__m256i *) (d+8*i), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *) (d+8*i+32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	interleave32Scalar(d+8*i, t, s+4*i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void interleave64Avx2(char * d, const uint64_t t, const char * s, size_t n) {
+	const __m256i tags=_mm256_set1_epi64x(t);
+	size_t i=0;
+	for (; i+4<=n; i+=4) {
+		__m256i v=_mm256_loadu_si256((const __m256i *) (s+8*i));
+		__m256i lo=_mm256_unpacklo_epi64(tags, v);
+		__m256i hi=_mm256_unpackhi_epi64(tags, v);
+		_mm256_storeu_si256((__m256i *) (d+16*i), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *) (d+16*i+32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	interleave64Scalar(d+16*i, t, s+8*i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void deinterleave32Avx2(char * d, const char * s, size_t n) {
+	size_t i=0;
+	for (; i+8<=n; i+=8) {
+		__m256 a=_mm256_loadu_ps((const float *) (s+8*i));
+		__m256 b=_mm256_loadu_ps((const float *) (s+8*i+32));
+		__m256d v=_mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		_mm256_storeu_pd((double *) (d+4*i), _mm256_permute4x64_pd(v, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	deinterleave32Scalar(d+4*i, s+8*i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void deinterleave64Avx2(char * d, const char * s, size_t n) {
+	size_t i=0;
+	for (; i+4<=n; i+=4) {
+		__m256d a=_mm256_loadu_pd((const double *) (s+16*i));
+		__m256d b=_mm256_loadu_pd((const double *) (s+16*i+32));
+		_mm256_storeu_pd((double *) (d+8*i), _mm256_permute4x64_pd(_mm256_unpackhi_pd(a, b), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	deinterleave64Scalar(d+8*i, s+16*i, n-i);
+}
+
+#endif
+
+namespace {
+	struct Kernels {
+		void (*bswap32)(char *, const char *, size_t);
+		void (*bswap64)(char *, const char *, size_t);
+		void (*narrow)(float *, const char *, size_t);
+		void (*widen)(char *, const float *, size_t);
+		void (*interleave32)(char *, const uint32_t, const char *, size_t);
+		void (*interleave64)(char *, const uint64_t, const char *, size_t);
+		void (*deinterleave32)(char *, const char *, size_t);
+		void (*deinterleave64)(char *, const char *, size_t);
+		const char * name;
+	};
+
+	Kernels select() {
+		Kernels k={ bswap32Scalar, bswap64Scalar, narrowScalar, widenScalar, interleave32Scalar, interleave64Scalar, deinterleave32Scalar, deinterleave64Scalar, "scalar" };
+#ifdef EKERNELS_X86
+		const char * env=getenv("EBOTTLE_SIMD");
+		bool sse2=(env==NULL || strcmp(env, "scalar")!=0);
+		bool avx2=(env==NULL || strcmp(env, "avx2")==0);
+		__builtin_cpu_init();
+		if (sse2 && __builtin_cpu_supports("sse2")) {
+			Kernels s={ bswap32Sse2, bswap64Sse2, narrowSse2, widenSse2, interleave32Sse2, interleave64Sse2, deinterleave32Sse2, deinterleave64Sse2, "sse2" };
+			k=s;
+		}
+		if (avx2 && __builtin_cpu_supports("avx2")) {
+			Kernels a={ bswap32Avx2, bswap64Avx2, narrowAvx2, widenAvx2, interleave32Avx2, interleave64Avx2, deinterleave32Avx2, deinterleave64Avx2, "avx2" };
+			k=a;
+		}
+#endif
+		return k;
+	}
+
+	// chosen once, the first time a kernel is used
+	const Kernels & kernels() {
+		static const Kernels k=select();
+		return k;
+	}
+}
+
+void yarp::os::eKernels::copy(void * dst, const void * src, const size_t bytes) {
+	// the C library already has the best copy for the processor
+	if (bytes>0) {
+		memcpy(dst, src, bytes);
+	}
+}
+
+void yarp::os::eKernels::bswap32(void * dst, const void * src, const size_t n) {
+	kernels().bswap32((char *) dst, (const char *) src, n);
+}
+
+void yarp::os::eKernels::bswap64(void * dst, const void * src, const size_t n) {
+	kernels().bswap64((char *) dst, (const char *) src, n);
+}
+
+void yarp::os::eKernels::narrow(float * dst, const void * src, const size_t n) {
+	kernels().narrow(dst, (const char *) src, n);
+}
+
+void yarp::os::eKernels::widen(void * dst, const float * src, const size_t n) {
+	kernels().widen((char *) dst, src, n);
+}
+
+void yarp::os::eKernels::interleave32(void * dst, const uint32_t tag, const void * src, const size_t n) {
+	kernels().interleave32((char *) dst, tag, (const char *) src, n);
+}
+
+void yarp::os::eKernels::interleave64(void * dst, const uint64_t tag, const void * src, const size_t n) {
+	kernels().interleave64((char *) dst, tag, (const char *) src, n);
+}
+
+void yarp::os::eKernels::deinterleave32(void * dst, const void * src, const size_t n) {
+	kernels().deinterleave32((char *) dst, (const char *) src, n);
+}
+
+void yarp::os::eKernels::deinterleave64(void * dst, const void * src, const size_t n) {
+	kernels().deinterleave64((char *) dst, (const char *) src, n);
+}
+
+const char * yarp::os::eKernels::name() {
+	return kernels().name;
+}
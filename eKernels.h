@@ -0,0 +1,170 @@
+/*------------------------------------------------------------------------
+ *  Copyright (C) 2000-2008, Universidad de Zaragoza, SPAIN
+ *
+ *  Contact Addresses: Danilo Tardioli                   dantard@unizar.es
+ *
+ *  eBottle is free software;  you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation;  either version 2, or (at your option) any
+ *  later version.
+ *
+ *  eBottle is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  distributed with eBottle; see file COPYING. If not,  write to the
+ *  Free Software  Foundation, 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ *  As a special exception, if you link this unit with other files to
+ *  produce an executable, this unit does not by itself cause the resulting
+ *  executable to be covered by the GNU General Public License.  This
+ *  exception does not however invalidate any other reasons why the
+ *  executable file might be covered by the GNU Public License.
+ *
+ *-------------------------------------------------------------------------*/
+
+/** \file eKernels.h
+ * 
+ * \brief Bulk conversion kernels for numeric payloads
+ * 
+ * These functions move runs of numbers between eValues and binary 
+ * buffers: the payloads of arrays, and runs of int or double eValues, 
+ * which are gathered first as each one lives in its own node. Each one 
+ * has a scalar version and, on x86, SSE2 and AVX2 versions; the best 
+ * one supported by the processor is chosen the first time a kernel is 
+ * used. Setting the EBOTTLE_SIMD environment variable to "scalar", 
+ * "sse2" or "avx2" forces a lower level.
+ * 
+ * None of the pointers need to be aligned.
+ */
+
+#ifndef EKERNELS_H_
+#define EKERNELS_H_
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace yarp {
+
+	namespace os {
+
+		/**
+		 * \brief Bulk conversion kernels
+		 */
+		namespace eKernels {
+
+			/**
+			 * Reverses the order of the bytes of a 32 bit word
+			 */
+			inline uint32_t swap32(const uint32_t v) {
+				return (v>>24) | ((v>>8)&0xff00) | ((v<<8)&0xff0000) | (v<<24);
+			}
+
+			/**
+			 * Reverses the order of the bytes of a 64 bit word
+			 */
+			inline uint64_t swap64(const uint64_t v) {
+				return ((uint64_t) swap32((uint32_t) v)<<32) | swap32((uint32_t) (v>>32));
+			}
+
+			/**
+			 * Copies a block of memory
+			 * 
+			 * \param[out] dst The destination
+			 * \param[in] src The source
+			 * \param[in] bytes The amount of bytes to copy
+			 */
+			void copy(void * dst, const void * src, const size_t bytes);
+
+			/**
+			 * Copies 32 bit words reversing the order of their bytes
+			 * 
+			 * \param[out] dst The destination
+			 * \param[in] src The source, which may be the same as \p dst
+			 * \param[in] n The amount of words
+			 */
+			void bswap32(void * dst, const void * src, const size_t n);
+
+			/**
+			 * Copies 64 bit words reversing the order of their bytes
+			 * 
+			 * \param[out] dst The destination
+			 * \param[in] src The source, which may be the same as \p dst
+			 * \param[in] n The amount of words
+			 */
+			void bswap64(void * dst, const void * src, const size_t n);
+
+			/**
+			 * Converts doubles to floats
+			 * 
+			 * \param[out] dst The floats
+			 * \param[in] src The doubles
+			 * \param[in] n The amount of numbers
+			 */
+			void narrow(float * dst, const void * src, const size_t n);
+
+			/**
+			 * Converts floats to doubles
+			 * 
+			 * \param[out] dst The doubles
+			 * \param[in] src The floats
+			 * \param[in] n The amount of numbers
+			 */
+			void widen(void * dst, const float * src, const size_t n);
+
+			/**
+			 * Writes 32 bit words each after a copy of a tag, as runs of 
+			 * ints are laid out in a message
+			 * 
+			 * \param[out] dst The 2*n words
+			 * \param[in] tag The word written before each one
+			 * \param[in] src The words
+			 * \param[in] n The amount of words
+			 */
+			void interleave32(void * dst, const uint32_t tag, const void * src, const size_t n);
+
+			/**
+			 * Writes 64 bit words each after a copy of a tag, as runs of 
+			 * doubles are laid out in a message
+			 * 
+			 * \param[out] dst The 2*n words
+			 * \param[in] tag The word written before each one
+			 * \param[in] src The words
+			 * \param[in] n The amount of words
+			 */
+			void interleave64(void * dst, const uint64_t tag, const void * src, const size_t n);
+
+			/**
+			 * Takes the second 32 bit word of each pair, the reverse of 
+			 * interleave32
+			 * 
+			 * \param[out] dst The n words
+			 * \param[in] src The 2*n words
+			 * \param[in] n The amount of pairs
+			 */
+			void deinterleave32(void * dst, const void * src, const size_t n);
+
+			/**
+			 * Takes the second 64 bit word of each pair, the reverse of 
+			 * interleave64
+			 * 
+			 * \param[out] dst The n words
+			 * \param[in] src The 2*n words
+			 * \param[in] n The amount of pairs
+			 */
+			void deinterleave64(void * dst, const void * src, const size_t n);
+
+			/**
+			 * Access to the kernels in use
+			 * 
+			 * \return "avx2", "sse2" or "scalar"
+			 */
+			const char * name();
+		}
+	}
+}
+
+#endif /*EKERNELS_H_*/
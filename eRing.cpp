@@ -0,0 +1,174 @@
+/*------------------------------------------------------------------------
+ *  Copyright (C) 2000-2008, Universidad de Zaragoza, SPAIN
+ *
+ *  Contact Addresses: Danilo Tardioli                   dantard@unizar.es
+ *
+ *  eBottle is free software;  you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation;  either version 2, or (at your option) any
+ *  later version.
+ *
+ *  eBottle is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  distributed with eBottle; see file COPYING. If not,  write to the
+ *  Free Software  Foundation, 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ *  As a special exception, if you link this unit with other files to
+ *  produce an executable, this unit does not by itself cause the resulting
+ *  executable to be covered by the GNU General Public License.  This
+ *  exception does not however invalidate any other reasons why the
+ *  executable file might be covered by the GNU Public License.
+ *
+ *-------------------------------------------------------------------------*/
+#include <yarp/os/eRing.h>
+#include <thread>
+
+using yarp::os::eBottle;
+using yarp::os::eBottleRing;
+using yarp::os::eBottleMultiRing;
+
+// spins for a while before giving the processor away
+static const int SPINS=64;
+
+static inline void backOff(int & spins) {
+	if (++spins>SPINS) {
+		std::this_thread::yield();
+	}
+}
+
+static unsigned int roundUp(const unsigned int n) {
+	unsigned int c=1;
+	while (c<n && c<(1u<<31)) {
+		c<<=1;
+	}
+	return c;
+}
+
+static eBottle * makeSlots(const unsigned int n) {
+	eBottle * slots=new eBottle[n];
+	for (unsigned int i=0; i<n; i++) {
+		slots[i].useArena();
+	}
+	return slots;
+}
+
+eBottleRing::eBottleRing(const unsigned int capacity) : head(0), knownTail(0), tail(0), knownHead(0) {
+	mask=roundUp(capacity)-1;
+	slots=makeSlots(mask+1);
+}
+
+eBottleRing::~eBottleRing() {
+	delete [] slots;
+}
+
+eBottle * eBottleRing::prepare(const bool shouldWait) {
+	const unsigned int h=head.load(std::memory_order_relaxed);
+	int spins=0;
+	while (h-knownTail>mask) {
+		knownTail=tail.load(std::memory_order_acquire);
+		if (h-knownTail<=mask) {
+			break;
+		}
+		if (!shouldWait) {
+			return NULL;
+		}
+		backOff(spins);
+	}
+	return &slots[h & mask];
+}
+
+void eBottleRing::write() {
+	head.store(head.load(std::memory_order_relaxed)+1, std::memory_order_release);
+}
+
+eBottle * eBottleRing::read(const bool shouldWait) {
+	const unsigned int t=tail.load(std::memory_order_relaxed);
+	int spins=0;
+	while (t==knownHead) {
+		knownHead=head.load(std::memory_order_acquire);
+		if (t!=knownHead) {
+			break;
+		}
+		if (!shouldWait) {
+			return NULL;
+		}
+		backOff(spins);
+	}
+	return &slots[t & mask];
+}
+
+void eBottleRing::done() {
+	tail.store(tail.load(std::memory_order_relaxed)+1, std::memory_order_release);
+}
+
+unsigned int eBottleRing::capacity() const {
+	return mask+1;
+}
+
+eBottleMultiRing::eBottleMultiRing(const unsigned int capacity) : head(0), tail(0) {
+	mask=roundUp(capacity)-1;
+	slots=makeSlots(mask+1);
+	turns=new std::atomic<unsigned int>[mask+1];
+	for (unsigned int i=0; i<=mask; i++) {
+		turns[i].store(i, std::memory_order_relaxed);
+	}
+}
+
+eBottleMultiRing::~eBottleMultiRing() {
+	delete [] turns;
+	delete [] slots;
+}
+
+eBottle * eBottleMultiRing::prepare(const bool shouldWait) {
+	unsigned int h=head.load(std::memory_order_relaxed);
+	int spins=0;
+	while (true) {
+		int d=(int) (turns[h & mask].load(std::memory_order_acquire)-h);
+		if (d==0) {
+			if (head.compare_exchange_weak(h, h+1, std::memory_order_relaxed)) {
+				return &slots[h & mask];
+			}
+		} else if (d<0) {
+			// the slot has not been read since the last lap
+			if (!shouldWait) {
+				return NULL;
+			}
+			backOff(spins);
+			h=head.load(std::memory_order_relaxed);
+		} else {
+			// another producer took it
+			h=head.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+void eBottleMultiRing::write(eBottle * b) {
+	const unsigned int i=b-slots;
+	turns[i].store(turns[i].load(std::memory_order_relaxed)+1, std::memory_order_release);
+}
+
+eBottle * eBottleMultiRing::read(const bool shouldWait) {
+	std::atomic<unsigned int> & turn=turns[tail & mask];
+	int spins=0;
+	while (turn.load(std::memory_order_acquire)!=tail+1) {
+		if (!shouldWait) {
+			return NULL;
+		}
+		backOff(spins);
+	}
+	return &slots[tail & mask];
+}
+
+void eBottleMultiRing::done() {
+	turns[tail & mask].store(tail+mask+1, std::memory_order_release);
+	tail++;
+}
+
+unsigned int eBottleMultiRing::capacity() const {
+	return mask+1;
+}
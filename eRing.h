@@ -0,0 +1,211 @@
+/*------------------------------------------------------------------------
+ *  Copyright (C) 2000-2008, Universidad de Zaragoza, SPAIN
+ *
+ *  Contact Addresses: Danilo Tardioli                   dantard@unizar.es
+ *
+ *  eBottle is free software;  you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation;  either version 2, or (at your option) any
+ *  later version.
+ *
+ *  eBottle is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  distributed with eBottle; see file COPYING. If not,  write to the
+ *  Free Software  Foundation, 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ *  As a special exception, if you link this unit with other files to
+ *  produce an executable, this unit does not by itself cause the resulting
+ *  executable to be covered by the GNU General Public License.  This
+ *  exception does not however invalidate any other reasons why the
+ *  executable file might be covered by the GNU Public License.
+ *
+ *-------------------------------------------------------------------------*/
+
+/** \file eRing.h
+ * 
+ * \brief Lock-free rings of eBottles for pipelines inside a process
+ * 
+ * The rings hold a fixed set of eBottles, constructed once in arena mode. 
+ * A producer takes a free slot, fills it in place and publishes it; the 
+ * consumer reads the slot where it is and hands it back. Nothing is 
+ * serialized or copied, and once the arenas of the slots have grown to 
+ * the size of the messages nothing is allocated either.
+ * 
+ * A slot keeps the contents of its previous message, so producers 
+ * normally clear() it first, or overwrite its values when the shape of 
+ * the messages does not change.
+ */
+
+#ifndef ERING_H_
+#define ERING_H_
+
+#include <yarp/os/eBottle.h>
+#include <atomic>
+
+namespace yarp {
+
+	namespace os {
+
+		/**
+		 * \brief Single producer, single consumer ring of eBottles
+		 * 
+		 * One thread may call prepare() and write() and another one read() 
+		 * and done(), with the same sequence as a BufferedPort.
+		 */
+		class eBottleRing {
+			public:
+				/**
+				 * \brief Capacity constructor
+				 * 
+				 * \param[in] capacity The amount of slots, rounded up to a 
+				 * power of 2
+				 */
+				explicit eBottleRing(const unsigned int capacity=16);
+
+				/**
+				 * \brief Destructor
+				 * 
+				 * Destroys the slots, which must not be in use
+				 */
+				~eBottleRing();
+
+				/**
+				 * Takes the next free slot to fill, the same one until write()
+				 * 
+				 * \param[in] shouldWait Whether to wait while the ring is full
+				 * \return The slot, or NULL if the ring is full and 
+				 * \p shouldWait is false
+				 */
+				eBottle * prepare(const bool shouldWait=true);
+
+				/**
+				 * Publishes the slot taken with prepare()
+				 */
+				void write();
+
+				/**
+				 * Gives the oldest published slot, the same one until done()
+				 * 
+				 * \param[in] shouldWait Whether to wait while the ring is empty
+				 * \return The slot, or NULL if the ring is empty and 
+				 * \p shouldWait is false
+				 */
+				eBottle * read(const bool shouldWait=true);
+
+				/**
+				 * Hands the slot given by read() back to the producer
+				 */
+				void done();
+
+				/**
+				 * Access to the ring size
+				 * 
+				 * \return The amount of slots
+				 */
+				unsigned int capacity() const;
+
+			private:
+				eBottleRing(const eBottleRing &);
+				eBottleRing & operator=(const eBottleRing &);
+
+				eBottle * slots;
+				unsigned int mask;
+				// each side writes its own cache line, and keeps the last 
+				// position seen of the other side to read the shared one 
+				// only when the ring looks full or empty
+				char before[64];
+				std::atomic<unsigned int> head;
+				unsigned int knownTail;
+				char between[64];
+				std::atomic<unsigned int> tail;
+				unsigned int knownHead;
+				char after[64];
+		};
+
+		/**
+		 * \brief Multiple producer, single consumer ring of eBottles
+		 * 
+		 * Any thread may call prepare() and write(), and each one can hold 
+		 * several slots at once. Slots are read in the order they were 
+		 * taken, so a producer that holds a slot for long delays the 
+		 * messages taken after it.
+		 */
+		class eBottleMultiRing {
+			public:
+				/**
+				 * \brief Capacity constructor
+				 * 
+				 * \param[in] capacity The amount of slots, rounded up to a 
+				 * power of 2
+				 */
+				explicit eBottleMultiRing(const unsigned int capacity=16);
+
+				/**
+				 * \brief Destructor
+				 * 
+				 * Destroys the slots, which must not be in use
+				 */
+				~eBottleMultiRing();
+
+				/**
+				 * Takes a free slot to fill
+				 * 
+				 * \param[in] shouldWait Whether to wait while the ring is full
+				 * \return The slot, or NULL if the ring is full and 
+				 * \p shouldWait is false
+				 */
+				eBottle * prepare(const bool shouldWait=true);
+
+				/**
+				 * Publishes a slot
+				 * 
+				 * \param[in] b A slot taken with prepare() by this thread
+				 */
+				void write(eBottle * b);
+
+				/**
+				 * Gives the oldest slot taken, once it is published, the same 
+				 * one until done()
+				 * 
+				 * \param[in] shouldWait Whether to wait while it is not
+				 * \return The slot, or NULL if it is not published and 
+				 * \p shouldWait is false
+				 */
+				eBottle * read(const bool shouldWait=true);
+
+				/**
+				 * Hands the slot given by read() back to the producers
+				 */
+				void done();
+
+				/**
+				 * Access to the ring size
+				 * 
+				 * \return The amount of slots
+				 */
+				unsigned int capacity() const;
+
+			private:
+				eBottleMultiRing(const eBottleMultiRing &);
+				eBottleMultiRing & operator=(const eBottleMultiRing &);
+
+				eBottle * slots;
+				// the position each slot is ready for: its own to be 
+				// written, one more to be read, a lap more to be written again
+				std::atomic<unsigned int> * turns;
+				unsigned int mask;
+				char before[64];
+				std::atomic<unsigned int> head;
+				char between[64];
+				unsigned int tail;
+				char after[64];
+		};
+	}
+}
+
+#endif /*ERING_H_*/
@@ -0,0 +1,71 @@
+/*------------------------------------------------------------------------
+ *  Copyright (C) 2000-2008, Universidad de Zaragoza, SPAIN
+ *
+ *  Contact Addresses: Danilo Tardioli                   dantard@unizar.es
+ *
+ *  eBottle is free software;  you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation;  either version 2, or (at your option) any
+ *  later version.
+ *
+ *  eBottle is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  distributed with eBottle; see file COPYING. If not,  write to the
+ *  Free Software  Foundation, 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ *  As a special exception, if you link this unit with other files to
+ *  produce an executable, this unit does not by itself cause the resulting
+ *  executable to be covered by the GNU General Public License.  This
+ *  exception does not however invalidate any other reasons why the
+ *  executable file might be covered by the GNU Public License.
+ *
+ *-------------------------------------------------------------------------*/
+#include <yarp/os/eSchema.h>
+#include <yarp/os/eWire.h>
+
+using yarp::os::ConnectionReader;
+using yarp::os::eSchemaBase;
+
+/*
+ * The header is the one of eBottle (see eBottle.cpp) with the SCHEMA 
+ * flag, followed by the hash of the layout and 4 bytes of padding, so 
+ * values start aligned to 8 bytes.
+ */
+void eSchemaBase::header(char * p, const uint32_t hash) {
+	memcpy(p, MAGIC, sizeof(MAGIC));
+	p[4]=VERSION;
+	p[5]=SCHEMA_FLAG | (hostBigEndian() ? BIG_ENDIAN_FLAG : 0);
+	p[6]=0;
+	p[7]=0;
+	memcpy(p+8, &hash, sizeof(hash));
+	memset(p+12, 0, 4);
+}
+
+bool eSchemaBase::check(const char * p, const int size, const uint32_t hash, bool & swap) {
+	if (size<(int) HEADER_SIZE || memcmp(p, MAGIC, sizeof(MAGIC))!=0 || (unsigned char) p[4]!=VERSION || (p[5] & ~BIG_ENDIAN_FLAG)!=SCHEMA_FLAG) {
+		return false;
+	}
+	swap=((p[5] & BIG_ENDIAN_FLAG)!=0)!=hostBigEndian();
+	uint32_t h;
+	memcpy(&h, p+8, sizeof(h));
+	return (swap ? yarp::os::eKernels::swap32(h) : h)==hash;
+}
+
+uint32_t eSchemaBase::hash(const std::string & signature) {
+	return fnv1a(signature.data(), signature.length());
+}
+
+bool eSchemaBase::receive(ConnectionReader & connection, std::vector<char> & buffer) {
+	const int size=connection.expectInt();
+	if (size<(int) HEADER_SIZE) {
+		return false;
+	}
+	buffer.resize(size);
+	connection.expectBlock(&buffer[0], size);
+	return !connection.isError();
+}
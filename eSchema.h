@@ -0,0 +1,553 @@
+/*------------------------------------------------------------------------
+ *  Copyright (C) 2000-2008, Universidad de Zaragoza, SPAIN
+ *
+ *  Contact Addresses: Danilo Tardioli                   dantard@unizar.es
+ *
+ *  eBottle is free software;  you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation;  either version 2, or (at your option) any
+ *  later version.
+ *
+ *  eBottle is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  distributed with eBottle; see file COPYING. If not,  write to the
+ *  Free Software  Foundation, 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ *  As a special exception, if you link this unit with other files to
+ *  produce an executable, this unit does not by itself cause the resulting
+ *  executable to be covered by the GNU General Public License.  This
+ *  exception does not however invalidate any other reasons why the
+ *  executable file might be covered by the GNU Public License.
+ *
+ *-------------------------------------------------------------------------*/
+
+/** \file eSchema.h
+ * 
+ * \brief eBottles with a layout fixed at compile time
+ * 
+ * An eBottleSchema holds a message whose types are given as template 
+ * parameters, in a std::tuple of plain C++ values. Its binary form has 
+ * no type tags and no value counts: each value is written at its natural 
+ * alignment, as a struct would be, after a header that carries a hash of 
+ * the layout. The code that writes and reads it is generated for the 
+ * layout, so nothing is dispatched at run time and a layout without 
+ * strings takes the same time as copying a struct.
+ * 
+ * The value types are
+ * - int and double
+ * - std::string, as a length and the characters
+ * - eIntArray<N> and eDoubleArray<N>, as std::array of N numbers
+ * - eList<T...>, as a std::tuple of its values
+ * 
+ * For example 
+ * \code
+ * eBottleSchema<int, eDoubleArray<7>, eList<std::string, double, double> > m;
+ * m.get<0>()=3;
+ * std::get<1>(m.get<2>())=0.5;
+ * \endcode
+ * 
+ * The binary form is not the eBottle one: its header has a flag that 
+ * eBottle rejects, so a plain eBottle port refuses these messages. 
+ * toBottle and fromBottle convert the values for generic tools.
+ */
+
+#ifndef ESCHEMA_H_
+#define ESCHEMA_H_
+
+#include <yarp/os/eBottle.h>
+#include <yarp/os/eKernels.h>
+#include <array>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace yarp {
+
+	namespace os {
+
+		/**
+		 * \brief Schema type of a list of values, held as std::tuple
+		 */
+		template <class... T> struct eList {};
+
+		/**
+		 * \brief Schema type of an array of N integers, held as std::array
+		 */
+		template <unsigned int N> struct eIntArray {};
+
+		/**
+		 * \brief Schema type of an array of N doubles, held as std::array
+		 */
+		template <unsigned int N> struct eDoubleArray {};
+
+		/**
+		 * \brief Coding of one schema type
+		 * 
+		 * Each specialization gives the C++ type that holds the value and 
+		 * how it is measured, written, read and converted, with s being 
+		 * the position in the binary form.
+		 */
+		template <class T> struct eSchemaField;
+
+		/**
+		 * \brief The parts of eBottleSchema that do not depend on the layout
+		 */
+		class eSchemaBase {
+			public:
+				/**
+				 * Size of the header: the eBottle header with the schema 
+				 * flag, the hash of the layout and padding
+				 */
+				static const unsigned int HEADER_SIZE = 16;
+
+			protected:
+				// writes the header of a message, in the byte order of the host
+				static void header(char * p, const uint32_t hash);
+				// checks the header of a message, telling its byte order
+				static bool check(const char * p, const int size, const uint32_t hash, bool & swap);
+				static uint32_t hash(const std::string & signature);
+				// takes a message from a connection into the buffer
+				static bool receive(ConnectionReader & connection, std::vector<char> & buffer);
+		};
+
+		/*
+		 * Field coding
+		 */
+		inline unsigned int eSchemaAlign(const unsigned int s, const unsigned int n) {
+			return (s+n-1) & ~(n-1);
+		}
+
+		// aligns s for writing, zeroing the bytes skipped so that equal 
+		// values always give the same message
+		inline void eSchemaPad(char * p, unsigned int & s, const unsigned int n) {
+			const unsigned int a=eSchemaAlign(s, n);
+			memset(p+s, 0, a-s);
+			s=a;
+		}
+
+		template <> struct eSchemaField<int> {
+			typedef int type;
+			static void sign(std::string & s) {
+				s+='i';
+			}
+			static void measure(unsigned int & s, const type &) {
+				s=eSchemaAlign(s, sizeof(int))+sizeof(int);
+			}
+			static void put(char * p, unsigned int & s, const type & v) {
+				eSchemaPad(p, s, sizeof(int));
+				memcpy(p+s, &v, sizeof(int));
+				s+=sizeof(int);
+			}
+			static bool get(const char * p, const unsigned int size, unsigned int & s, type & v, const bool swap) {
+				s=eSchemaAlign(s, sizeof(int));
+				if (s+sizeof(int)>size) {
+					return false;
+				}
+				uint32_t u;
+				memcpy(&u, p+s, sizeof(u));
+				v=(int) (swap ? eKernels::swap32(u) : u);
+				s+=sizeof(int);
+				return true;
+			}
+			static void add(eBottle & b, const type & v) {
+				b.addInt(v);
+			}
+			static bool take(const eValue & e, type & v) {
+				if (e.getType()!=eValue::INT) {
+					return false;
+				}
+				v=e.asInt();
+				return true;
+			}
+		};
+
+		template <> struct eSchemaField<double> {
+			typedef double type;
+			static void sign(std::string & s) {
+				s+='d';
+			}
+			static void measure(unsigned int & s, const type &) {
+				s=eSchemaAlign(s, sizeof(double))+sizeof(double);
+			}
+			static void put(char * p, unsigned int & s, const type & v) {
+				eSchemaPad(p, s, sizeof(double));
+				memcpy(p+s, &v, sizeof(double));
+				s+=sizeof(double);
+			}
+			static bool get(const char * p, const unsigned int size, unsigned int & s, type & v, const bool swap) {
+				s=eSchemaAlign(s, sizeof(double));
+				if (s+sizeof(double)>size) {
+					return false;
+				}
+				uint64_t u;
+				memcpy(&u, p+s, sizeof(u));
+				if (swap) {
+					u=eKernels::swap64(u);
+				}
+				memcpy(&v, &u, sizeof(double));
+				s+=sizeof(double);
+				return true;
+			}
+			static void add(eBottle & b, const type & v) {
+				b.addDouble(v);
+			}
+			static bool take(const eValue & e, type & v) {
+				if (e.getType()!=eValue::DOUBLE) {
+					return false;
+				}
+				v=e.asDouble();
+				return true;
+			}
+		};
+
+		template <> struct eSchemaField<std::string> {
+			typedef std::string type;
+			static void sign(std::string & s) {
+				s+='s';
+			}
+			static void measure(unsigned int & s, const type & v) {
+				s=eSchemaAlign(s, sizeof(int))+sizeof(int)+v.length();
+			}
+			static void put(char * p, unsigned int & s, const type & v) {
+				const int n=v.length();
+				eSchemaField<int>::put(p, s, n);
+				memcpy(p+s, v.data(), n);
+				s+=n;
+			}
+			static bool get(const char * p, const unsigned int size, unsigned int & s, type & v, const bool swap) {
+				int n;
+				if (!eSchemaField<int>::get(p, size, s, n, swap) || n<0 || (unsigned int) n>size-s) {
+					return false;
+				}
+				// keeps the capacity of the previous message
+				v.assign(p+s, n);
+				s+=n;
+				return true;
+			}
+			static void add(eBottle & b, const type & v) {
+				b.addString(v);
+			}
+			static bool take(const eValue & e, type & v) {
+				if (e.getType()!=eValue::STRING) {
+					return false;
+				}
+				const ConstString c=e.asString();
+				v.assign(c.c_str(), c.length());
+				return true;
+			}
+		};
+
+		template <unsigned int N> struct eSchemaField< eIntArray<N> > {
+			typedef std::array<int, N> type;
+			static void sign(std::string & s) {
+				s+="I"+std::to_string(N)+";";
+			}
+			static void measure(unsigned int & s, const type &) {
+				s=eSchemaAlign(s, sizeof(int))+N*sizeof(int);
+			}
+			static void put(char * p, unsigned int & s, const type & v) {
+				eSchemaPad(p, s, sizeof(int));
+				memcpy(p+s, v.data(), N*sizeof(int));
+				s+=N*sizeof(int);
+			}
+			static bool get(const char * p, const unsigned int size, unsigned int & s, type & v, const bool swap) {
+				s=eSchemaAlign(s, sizeof(int));
+				if (s+N*sizeof(int)>size) {
+					return false;
+				}
+				if (swap) {
+					eKernels::bswap32(v.data(), p+s, N);
+				} else {
+					memcpy(v.data(), p+s, N*sizeof(int));
+				}
+				s+=N*sizeof(int);
+				return true;
+			}
+			static void add(eBottle & b, const type & v) {
+				b.addIntArray(v.data(), N);
+			}
+			static bool take(const eValue & e, type & v) {
+				if (e.getType()!=eValue::INT_ARRAY || e.asArrayLength()!=N) {
+					return false;
+				}
+				memcpy(v.data(), e.asIntArray(), N*sizeof(int));
+				return true;
+			}
+		};
+
+		template <unsigned int N> struct eSchemaField< eDoubleArray<N> > {
+			typedef std::array<double, N> type;
+			static void sign(std::string & s) {
+				s+="D"+std::to_string(N)+";";
+			}
+			static void measure(unsigned int & s, const type &) {
+				s=eSchemaAlign(s, sizeof(double))+N*sizeof(double);
+			}
+			static void put(char * p, unsigned int & s, const type & v) {
+				eSchemaPad(p, s, sizeof(double));
+				memcpy(p+s, v.data(), N*sizeof(double));
+				s+=N*sizeof(double);
+			}
+			static bool get(const char * p, const unsigned int size, unsigned int & s, type & v, const bool swap) {
+				s=eSchemaAlign(s, sizeof(double));
+				if (s+N*sizeof(double)>size) {
+					return false;
+				}
+				if (swap) {
+					eKernels::bswap64(v.data(), p+s, N);
+				} else {
+					memcpy(v.data(), p+s, N*sizeof(double));
+				}
+				s+=N*sizeof(double);
+				return true;
+			}
+			static void add(eBottle & b, const type & v) {
+				b.addDoubleArray(v.data(), N);
+			}
+			static bool take(const eValue & e, type & v) {
+				if (e.getType()!=eValue::DOUBLE_ARRAY || e.asArrayLength()!=N) {
+					return false;
+				}
+				memcpy(v.data(), e.asDoubleArray(), N*sizeof(double));
+				return true;
+			}
+		};
+
+		/*
+		 * The values of a list, from the I-th one on
+		 */
+		template <unsigned int I, class... T> struct eSchemaTuple {
+			static const unsigned int SIZE = 0;
+			static void sign(std::string &) {}
+			template <class U> static void measure(unsigned int &, const U &) {}
+			template <class U> static void put(char *, unsigned int &, const U &) {}
+			template <class U> static bool get(const char *, const unsigned int, unsigned int &, U &, const bool) {
+				return true;
+			}
+			template <class U> static void add(eBottle &, const U &) {}
+			template <class U> static bool take(const eBottle &, U &) {
+				return true;
+			}
+		};
+
+		template <unsigned int I, class H, class... T> struct eSchemaTuple<I, H, T...> {
+			typedef eSchemaTuple<I+1, T...> Rest;
+			static const unsigned int SIZE = Rest::SIZE+1;
+			static void sign(std::string & s) {
+				eSchemaField<H>::sign(s);
+				Rest::sign(s);
+			}
+			template <class U> static void measure(unsigned int & s, const U & v) {
+				eSchemaField<H>::measure(s, std::get<I>(v));
+				Rest::measure(s, v);
+			}
+			template <class U> static void put(char * p, unsigned int & s, const U & v) {
+				eSchemaField<H>::put(p, s, std::get<I>(v));
+				Rest::put(p, s, v);
+			}
+			template <class U> static bool get(const char * p, const unsigned int size, unsigned int & s, U & v, const bool swap) {
+				return eSchemaField<H>::get(p, size, s, std::get<I>(v), swap) && Rest::get(p, size, s, v, swap);
+			}
+			template <class U> static void add(eBottle & b, const U & v) {
+				eSchemaField<H>::add(b, std::get<I>(v));
+				Rest::add(b, v);
+			}
+			template <class U> static bool take(const eBottle & b, U & v) {
+				return eSchemaField<H>::take(b.get(I), std::get<I>(v)) && Rest::take(b, v);
+			}
+		};
+
+		template <class... T> struct eSchemaField< eList<T...> > {
+			typedef std::tuple<typename eSchemaField<T>::type...> type;
+			typedef eSchemaTuple<0, T...> Values;
+			static void sign(std::string & s) {
+				s+='(';
+				Values::sign(s);
+				s+=')';
+			}
+			static void measure(unsigned int & s, const type & v) {
+				Values::measure(s, v);
+			}
+			static void put(char * p, unsigned int & s, const type & v) {
+				Values::put(p, s, v);
+			}
+			static bool get(const char * p, const unsigned int size, unsigned int & s, type & v, const bool swap) {
+				return Values::get(p, size, s, v, swap);
+			}
+			static void add(eBottle & b, const type & v) {
+				Values::add(b.addList(), v);
+			}
+			static bool take(const eValue & e, type & v) {
+				return e.getType()==eValue::BOTTLE && takeAll(*e.asList(), v);
+			}
+			static bool takeAll(const eBottle & b, type & v) {
+				return b.size()==Values::SIZE && Values::take(b, v);
+			}
+		};
+
+		/**
+		 * \brief Message with a layout fixed at compile time
+		 * 
+		 * The template parameters are the types of the top level values, 
+		 * see eSchema.h. Both ends of a connection must use the same 
+		 * layout; a message with another one is refused.
+		 */
+		template <class... T> class eBottleSchema : public Portable, protected eSchemaBase {
+			public:
+				/**
+				 * The C++ types of the values
+				 */
+				typedef typename eSchemaField< eList<T...> >::type Tuple;
+
+				/**
+				 * \brief Default constructor
+				 * 
+				 * Numbers are value-initialized and strings are empty
+				 */
+				eBottleSchema() : values() {}
+
+				/**
+				 * Access to a value
+				 * 
+				 * \return The I-th top level value
+				 */
+				template <unsigned int I> typename std::tuple_element<I, Tuple>::type & get() {
+					return std::get<I>(values);
+				}
+
+				/**
+				 * Access to a value
+				 * 
+				 * \return The I-th top level value
+				 */
+				template <unsigned int I> const typename std::tuple_element<I, Tuple>::type & get() const {
+					return std::get<I>(values);
+				}
+
+				/**
+				 * Access to all the values
+				 * 
+				 * \return The tuple of the top level values
+				 */
+				Tuple & tuple() {
+					return values;
+				}
+
+				/**
+				 * Access to all the values
+				 * 
+				 * \return The tuple of the top level values
+				 */
+				const Tuple & tuple() const {
+					return values;
+				}
+
+				/**
+				 * Gives the hash of the layout, which travels in the header
+				 * 
+				 * \return The hash of the type parameters
+				 */
+				static uint32_t layout() {
+					static const uint32_t h=hash(signature());
+					return h;
+				}
+
+				/**
+				 * Gives the size of the binary representation
+				 * 
+				 * \return The size in bytes
+				 */
+				unsigned int getBinarySize() const {
+					unsigned int s=HEADER_SIZE;
+					eSchemaField< eList<T...> >::measure(s, values);
+					return s;
+				}
+
+				/**
+				 * Writes the binary representation, in the byte order of 
+				 * the host
+				 * 
+				 * \param[out] p The place for getBinarySize() bytes
+				 * \return The size written
+				 */
+				int toBinary(char * p) const {
+					header(p, layout());
+					unsigned int s=HEADER_SIZE;
+					eSchemaField< eList<T...> >::put(p, s, values);
+					return s;
+				}
+
+				/**
+				 * Reads a binary representation
+				 * 
+				 * \param[in] p The message
+				 * \param[in] size Its size
+				 * \return False if the message is not a complete one of this 
+				 * layout, in which case the values may be partly updated
+				 */
+				bool fromBinary(const char * p, const int size) {
+					bool swap;
+					if (!check(p, size, layout(), swap)) {
+						return false;
+					}
+					unsigned int s=HEADER_SIZE;
+					return eSchemaField< eList<T...> >::get(p, size, s, values, swap) && s==(unsigned int) size;
+				}
+
+				/**
+				 * Copies the values to an eBottle, replacing its contents
+				 * 
+				 * \param[out] b The eBottle
+				 */
+				void toBottle(eBottle & b) const {
+					b.clear();
+					eSchemaTuple<0, T...>::add(b, values);
+				}
+
+				/**
+				 * Takes the values from an eBottle with the same shape
+				 * 
+				 * \param[in] b The eBottle
+				 * \return False if the types or amounts of values differ, in 
+				 * which case nothing changes
+				 */
+				bool fromBottle(const eBottle & b) {
+					Tuple v;
+					if (!eSchemaField< eList<T...> >::takeAll(b, v)) {
+						return false;
+					}
+					values=std::move(v);
+					return true;
+				}
+
+				virtual bool write(ConnectionWriter & connection) {
+					buffer.resize(getBinarySize());
+					connection.appendInt(buffer.size());
+					connection.appendBlock(&buffer[0], toBinary(&buffer[0]));
+					return true;
+				}
+
+				virtual bool read(ConnectionReader & connection) {
+					return receive(connection, buffer) && fromBinary(&buffer[0], buffer.size());
+				}
+
+			private:
+				static std::string signature() {
+					std::string s;
+					eSchemaField< eList<T...> >::sign(s);
+					return s;
+				}
+
+				Tuple values;
+				std::vector<char> buffer;
+		};
+	}
+}
+
+#endif /*ESCHEMA_H_*/
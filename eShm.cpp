@@ -0,0 +1,290 @@
+/*------------------------------------------------------------------------
+ *  Copyright (C) 2000-2008, Universidad de Zaragoza, SPAIN
+ *
+ *  Contact Addresses: Danilo Tardioli                   dantard@unizar.es
+ *
+ *  eBottle is free software;  you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation;  either version 2, or (at your option) any
+ *  later version.
+ *
+ *  eBottle is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  distributed with eBottle; see file COPYING. If not,  write to the
+ *  Free Software  Foundation, 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ *  As a special exception, if you link this unit with other files to
+ *  produce an executable, this unit does not by itself cause the resulting
+ *  executable to be covered by the GNU General Public License.  This
+ *  exception does not however invalidate any other reasons why the
+ *  executable file might be covered by the GNU Public License.
+ *
+ *-------------------------------------------------------------------------*/
+#include <yarp/os/eShm.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using yarp::os::eBottle;
+using yarp::os::eBottleView;
+using yarp::os::eShmWriter;
+using yarp::os::eShmReader;
+
+static const uint32_t READY=0x52744265;
+static const size_t CACHE_LINE=64;
+// size and padding before each message
+static const size_t SLOT_HEADER=2*sizeof(uint32_t);
+
+/*
+ * Beginning of the shared memory. The counters only grow, wrapping 
+ * around, and each one is written by one side only, in its own cache line.
+ */
+struct Ring {
+	std::atomic<uint32_t> ready;
+	uint32_t slots;
+	uint32_t slotSize;
+	uint32_t stride;
+	alignas(CACHE_LINE) std::atomic<uint32_t> written;
+	alignas(CACHE_LINE) std::atomic<uint32_t> released;
+};
+
+static const size_t RING_HEADER=(sizeof(Ring)+CACHE_LINE-1) & ~(CACHE_LINE-1);
+
+static std::string shmName(const char * name) {
+	std::string s="/eBottle";
+	for (const char * c=name; *c!='\0'; c++) {
+		s+=(*c=='/') ? '.' : *c;
+	}
+	return s;
+}
+
+static size_t strideOf(const unsigned int slotSize) {
+	return (SLOT_HEADER+slotSize+CACHE_LINE-1) & ~(CACHE_LINE-1);
+}
+
+// spins for a while, then yields, until ready() or the timeout expires
+template <class F> static bool waitFor(F ready, const double timeout) {
+	for (int i=0; i<64; i++) {
+		if (ready()) {
+			return true;
+		}
+	}
+	if (timeout<=0) {
+		return false;
+	}
+	std::chrono::steady_clock::time_point end=std::chrono::steady_clock::now()
+			+std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+	while (!ready()) {
+		if (std::chrono::steady_clock::now()>=end) {
+			return false;
+		}
+		std::this_thread::yield();
+	}
+	return true;
+}
+
+eShmWriter::eShmWriter() : ring(NULL), bytes(0) {
+}
+
+eShmWriter::~eShmWriter() {
+	close();
+}
+
+bool eShmWriter::open(const char * n, const unsigned int slots, const unsigned int slotSize) {
+	close();
+	if (n==NULL || slots==0 || slotSize>UINT32_MAX-CACHE_LINE) {
+		return false;
+	}
+	std::string s=shmName(n);
+	shm_unlink(s.c_str());
+	int fd=shm_open(s.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd<0) {
+		return false;
+	}
+	size_t size=RING_HEADER+slots*strideOf(slotSize);
+	void * p=MAP_FAILED;
+	if (ftruncate(fd, size)==0) {
+		p=mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	::close(fd);
+	if (p==MAP_FAILED) {
+		shm_unlink(s.c_str());
+		return false;
+	}
+	Ring * r=new (p) Ring;
+	r->slots=slots;
+	r->slotSize=slotSize;
+	r->stride=strideOf(slotSize);
+	r->written.store(0, std::memory_order_relaxed);
+	r->released.store(0, std::memory_order_relaxed);
+	r->ready.store(READY, std::memory_order_release);
+	name=s;
+	ring=(char *) p;
+	bytes=size;
+	return true;
+}
+
+void eShmWriter::close() {
+	if (ring==NULL) {
+		return;
+	}
+	munmap(ring, bytes);
+	shm_unlink(name.c_str());
+	ring=NULL;
+	bytes=0;
+}
+
+bool eShmWriter::isOpen() const {
+	return ring!=NULL;
+}
+
+bool eShmWriter::write(const eBottle & b, const double timeout) {
+	if (ring==NULL) {
+		return false;
+	}
+	Ring * r=(Ring *) ring;
+	if (b.getBinarySize()>r->slotSize) {
+		return false;
+	}
+	const uint32_t w=r->written.load(std::memory_order_relaxed);
+	if (!waitFor([&]() { return w-r->released.load(std::memory_order_acquire)<r->slots; }, timeout)) {
+		return false;
+	}
+	char * slot=ring+RING_HEADER+(size_t) (w%r->slots)*r->stride;
+	const int n=b.toBinary(slot+SLOT_HEADER);
+	if (n<0) {
+		// changed behind the size checked above
+		return false;
+	}
+	uint32_t size=n;
+	memcpy(slot, &size, sizeof(size));
+	memset(slot+sizeof(size), 0, sizeof(uint32_t));
+	r->written.store(w+1, std::memory_order_release);
+	return true;
+}
+
+eShmReader::eShmReader() : ring(NULL), bytes(0), slots(0), slotSize(0), holding(false) {
+}
+
+eShmReader::~eShmReader() {
+	close();
+}
+
+bool eShmReader::open(const char * n) {
+	close();
+	if (n==NULL) {
+		return false;
+	}
+	int fd=shm_open(shmName(n).c_str(), O_RDWR, 0);
+	if (fd<0) {
+		return false;
+	}
+	struct stat st;
+	void * p=MAP_FAILED;
+	if (fstat(fd, &st)==0 && (size_t) st.st_size>=RING_HEADER) {
+		p=mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	::close(fd);
+	if (p==MAP_FAILED) {
+		return false;
+	}
+	Ring * r=(Ring *) p;
+	// the sizes are kept, so that a wrong writer cannot make the reader 
+	// leave the mapping
+	if (r->ready.load(std::memory_order_acquire)!=READY || r->slots==0 || r->slotSize>UINT32_MAX-CACHE_LINE
+			|| r->stride!=strideOf(r->slotSize) || (st.st_size-RING_HEADER)/r->stride<r->slots) {
+		munmap(p, st.st_size);
+		return false;
+	}
+	ring=(char *) p;
+	bytes=st.st_size;
+	slots=r->slots;
+	slotSize=r->slotSize;
+	return true;
+}
+
+void eShmReader::close() {
+	if (ring==NULL) {
+		return;
+	}
+	release();
+	munmap(ring, bytes);
+	ring=NULL;
+	bytes=0;
+}
+
+bool eShmReader::isOpen() const {
+	return ring!=NULL;
+}
+
+void eShmReader::release() {
+	if (!holding) {
+		return;
+	}
+	Ring * r=(Ring *) ring;
+	r->released.store(r->released.load(std::memory_order_relaxed)+1, std::memory_order_release);
+	holding=false;
+}
+
+bool eShmReader::next(const char * & p, int & size, const double timeout) {
+	if (ring==NULL) {
+		return false;
+	}
+	release();
+	Ring * r=(Ring *) ring;
+	const uint32_t at=r->released.load(std::memory_order_relaxed);
+	if (!waitFor([&]() { return r->written.load(std::memory_order_acquire)!=at; }, timeout)) {
+		return false;
+	}
+	const char * slot=ring+RING_HEADER+(size_t) (at%slots)*strideOf(slotSize);
+	uint32_t n;
+	memcpy(&n, slot, sizeof(n));
+	holding=true;
+	if (n>slotSize) {
+		release();
+		return false;
+	}
+	p=slot+SLOT_HEADER;
+	size=n;
+	return true;
+}
+
+bool eShmReader::read(eBottleView & view, const double timeout) {
+	const char * p;
+	int size;
+	if (!next(p, size, timeout)) {
+		return false;
+	}
+	if (!eBottle::validate(p, size)) {
+		release();
+		return false;
+	}
+	view=eBottleView(p, size);
+	return true;
+}
+
+bool eShmReader::read(eBottle & b, const double timeout) {
+	const char * p;
+	int size;
+	if (!next(p, size, timeout)) {
+		return false;
+	}
+	// like eBottle::read, reusing the eValues of the previous message
+	bool ok=eBottle::validate(p, size);
+	if (ok) {
+		b.load(p, size);
+	}
+	release();
+	return ok;
+}
@@ -0,0 +1,208 @@
+/*------------------------------------------------------------------------
+ *  Copyright (C) 2000-2008, Universidad de Zaragoza, SPAIN
+ *
+ *  Contact Addresses: Danilo Tardioli                   dantard@unizar.es
+ *
+ *  eBottle is free software;  you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation;  either version 2, or (at your option) any
+ *  later version.
+ *
+ *  eBottle is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  distributed with eBottle; see file COPYING. If not,  write to the
+ *  Free Software  Foundation, 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ *  As a special exception, if you link this unit with other files to
+ *  produce an executable, this unit does not by itself cause the resulting
+ *  executable to be covered by the GNU General Public License.  This
+ *  exception does not however invalidate any other reasons why the
+ *  executable file might be covered by the GNU Public License.
+ *
+ *-------------------------------------------------------------------------*/
+
+/** \file eShm.h
+ * 
+ * \brief Shared memory transport of eBottles between local processes
+ * 
+ * An eShmWriter creates a ring of fixed size slots in POSIX shared 
+ * memory and serializes each eBottle straight into a slot; an eShmReader 
+ * in another process maps the same ring and gets each message as an 
+ * eBottleView of the slot, or decodes it, without the message going 
+ * through the kernel. Each ring has one writer and one reader.
+ * 
+ * The ring starts with a header holding the sizes of the ring and two 
+ * counters, of the messages written and of the messages released by the 
+ * reader. Each slot holds the size of the message, 4 zero bytes and the 
+ * binary representation of the eBottle.
+ */
+
+#ifndef ESHM_H_
+#define ESHM_H_
+
+#include <yarp/os/eBottle.h>
+#include <string>
+#include <stdint.h>
+
+namespace yarp {
+
+	namespace os {
+
+		/**
+		 * \brief Writing end of a shared memory ring
+		 * 
+		 * The names of the rings are like the ones of the ports ("/out"); 
+		 * the shared memory object is named after them.
+		 */
+		class eShmWriter {
+			public:
+				/**
+				 * \brief Default constructor
+				 * 
+				 * Creates a closed writer
+				 */
+				eShmWriter();
+
+				/**
+				 * \brief Destructor
+				 * 
+				 * Closes the writer
+				 */
+				~eShmWriter();
+
+				/**
+				 * Creates the ring, replacing any ring with the same name
+				 * 
+				 * \param[in] name The name of the ring
+				 * \param[in] slots The amount of messages the ring can hold
+				 * \param[in] slotSize The maximum binary size of a message
+				 * \return False if the ring could not be created
+				 */
+				bool open(const char * name, const unsigned int slots=8, const unsigned int slotSize=1<<20);
+
+				/**
+				 * Unmaps and removes the ring. The reader keeps its mapping 
+				 * until it is closed too.
+				 */
+				void close();
+
+				/**
+				 * Checks whether the ring is open
+				 * 
+				 * \return True if the writer is open
+				 */
+				bool isOpen() const;
+
+				/**
+				 * Serializes an eBottle into the next slot, and publishes it
+				 * 
+				 * \param[in] b The eBottle to send
+				 * \param[in] timeout Seconds to wait for a free slot, if the 
+				 * ring is full
+				 * \return False if the writer is closed, the message does not 
+				 * fit in a slot or the ring stayed full
+				 */
+				bool write(const eBottle & b, const double timeout=0);
+
+			private:
+				eShmWriter(const eShmWriter &);
+				eShmWriter & operator=(const eShmWriter &);
+
+				std::string name;
+				char * ring;
+				size_t bytes;
+		};
+
+		/**
+		 * \brief Reading end of a shared memory ring
+		 * 
+		 * A message stays in its slot, and the writer cannot reuse it, 
+		 * until the next read() or release().
+		 */
+		class eShmReader {
+			public:
+				/**
+				 * \brief Default constructor
+				 * 
+				 * Creates a closed reader
+				 */
+				eShmReader();
+
+				/**
+				 * \brief Destructor
+				 * 
+				 * Closes the reader
+				 */
+				~eShmReader();
+
+				/**
+				 * Maps a ring created by an eShmWriter
+				 * 
+				 * \param[in] name The name of the ring
+				 * \return False if there is no such ring
+				 */
+				bool open(const char * name);
+
+				/**
+				 * Unmaps the ring
+				 */
+				void close();
+
+				/**
+				 * Checks whether the ring is open
+				 * 
+				 * \return True if the reader is open
+				 */
+				bool isOpen() const;
+
+				/**
+				 * Gives the next message in place, releasing the previous one
+				 * 
+				 * \param[out] view A view of the message, valid until the 
+				 * next read() or release()
+				 * \param[in] timeout Seconds to wait for a message, if the 
+				 * ring is empty
+				 * \return False if there was no message, or it was invalid 
+				 * and has been released
+				 */
+				bool read(eBottleView & view, const double timeout=0);
+
+				/**
+				 * Decodes the next message, and releases it
+				 * 
+				 * \param[out] b The eBottle to fill, whose contents are 
+				 * replaced as eBottle::read does
+				 * \param[in] timeout Seconds to wait for a message, if the 
+				 * ring is empty
+				 * \return False if there was no message, or it was invalid
+				 */
+				bool read(eBottle & b, const double timeout=0);
+
+				/**
+				 * Hands the last message read back to the writer
+				 */
+				void release();
+
+			private:
+				eShmReader(const eShmReader &);
+				eShmReader & operator=(const eShmReader &);
+
+				bool next(const char * & p, int & size, const double timeout);
+
+				char * ring;
+				size_t bytes;
+				// sizes of the ring when it was opened
+				unsigned int slots;
+				unsigned int slotSize;
+				// whether the reader holds a slot
+				bool holding;
+		};
+	}
+}
+
+#endif /*ESHM_H_*/
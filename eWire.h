@@ -0,0 +1,81 @@
+/*------------------------------------------------------------------------
+ *  Copyright (C) 2000-2008, Universidad de Zaragoza, SPAIN
+ *
+ *  Contact Addresses: Danilo Tardioli                   dantard@unizar.es
+ *
+ *  eBottle is free software;  you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation;  either version 2, or (at your option) any
+ *  later version.
+ *
+ *  eBottle is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  distributed with eBottle; see file COPYING. If not,  write to the
+ *  Free Software  Foundation, 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ *  As a special exception, if you link this unit with other files to
+ *  produce an executable, this unit does not by itself cause the resulting
+ *  executable to be covered by the GNU General Public License.  This
+ *  exception does not however invalidate any other reasons why the
+ *  executable file might be covered by the GNU Public License.
+ *
+ *-------------------------------------------------------------------------*/
+
+/** \file eWire.h
+ * 
+ * \brief Constants of the binary header, shared by eBottle.cpp and 
+ * eSchema.cpp
+ * 
+ * Every message starts with the magic "eBtl", the version and a byte of 
+ * flags (see eBottle.cpp for the whole layout). This header is only 
+ * included by the translation units of the library.
+ */
+
+#ifndef EWIRE_H_
+#define EWIRE_H_
+
+#include <cstddef>
+#include <stdint.h>
+
+static const char MAGIC[4]={ 'e', 'B', 't', 'l' };
+static const unsigned char VERSION=2;
+
+// flags of the header
+static const unsigned char BIG_ENDIAN_FLAG=1;
+// messages of a delta stream, see eBottleDeltaWriter
+static const unsigned char DELTA_FLAG=2;
+static const unsigned char KEYFRAME_FLAG=4;
+// tagless messages of eBottleSchema
+static const unsigned char SCHEMA_FLAG=8;
+
+static inline bool hostBigEndian() {
+	const uint16_t one=1;
+	return *(const unsigned char *) &one==0;
+}
+
+/*
+ * FNV-1a, for the keys of the index of eBottle::find, the shapes of 
+ * delta streams and the layouts of eBottleSchema. fnvStep mixes in one 
+ * word, so a sequence of words can be hashed without turning it into 
+ * bytes.
+ */
+static const uint32_t FNV_BASIS=2166136261u;
+
+static inline uint32_t fnvStep(const uint32_t h, const uint32_t v) {
+	return (h^v)*16777619u;
+}
+
+static inline uint32_t fnv1a(const char * p, const size_t n) {
+	uint32_t h=FNV_BASIS;
+	for (size_t i=0; i<n; i++) {
+		h=fnvStep(h, (unsigned char) p[i]);
+	}
+	return h;
+}
+
+#endif /*EWIRE_H_*/
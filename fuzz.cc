@@ -0,0 +1,225 @@
+/*------------------------------------------------------------------------
+ *  Copyright (C) 2000-2008, Universidad de Zaragoza, SPAIN
+ *
+ *  Contact Addresses: Danilo Tardioli                   dantard@unizar.es
+ *
+ *  eBottle is free software;  you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation;  either version 2, or (at your option) any
+ *  later version.
+ *
+ *  eBottle is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  distributed with eBottle; see file COPYING. If not,  write to the
+ *  Free Software  Foundation, 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ *  As a special exception, if you link this unit with other files to
+ *  produce an executable, this unit does not by itself cause the resulting
+ *  executable to be covered by the GNU General Public License.  This
+ *  exception does not however invalidate any other reasons why the
+ *  executable file might be covered by the GNU Public License.
+ *
+ *-------------------------------------------------------------------------*/
+
+/*
+ * Fuzzing harness for the binary decoders.
+ * 
+ * Every input is given to eBottle::fromBinary, to eBottleDecoder in 
+ * small chunks and, through a loopback connection, to eBottle::read in 
+ * both decoding modes. Whatever decodes must encode and decode again, 
+ * with and without compression, to the same contents, and both decoders 
+ * must agree, and key lookups must find what a plain scan does.
+ * 
+ * Built with libFuzzer by "make fuzz". With FUZZ_STANDALONE defined it 
+ * has its own main that runs the files given as arguments instead, to 
+ * replay a corpus or a crash with any compiler.
+ */
+
+#include <yarp/os/eBottle.h>
+#include <yarp/os/all.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace yarp::os;
+
+// sends the input as the body of a message
+class RawMessage : public PortWriter {
+	public:
+		RawMessage(const uint8_t * d, size_t n) : data((const char *) d), size(n) {}
+		virtual bool write(ConnectionWriter& connection) {
+			connection.appendInt(size);
+			connection.appendBlock(data, size);
+			return true;
+		}
+	private:
+		const char * data;
+		int size;
+};
+
+static void walk(const eBottleView & v) {
+	for (unsigned int i=0; i<v.size(); i++) {
+		eValueView e=v.get(i);
+		switch (e.getType()) {
+			case eValue::INT:
+				e.asInt();
+				break;
+			case eValue::DOUBLE:
+				e.asDouble();
+				break;
+			case eValue::CHARP:
+			case eValue::STRING: {
+				std::vector<char> b(e.asBlobLength()+1);
+				e.asBlob(b.data());
+				break;
+			}
+			case eValue::INT_ARRAY: {
+				std::vector<int> a(e.asArrayLength()+1);
+				e.asIntArray(a.data());
+				break;
+			}
+			case eValue::DOUBLE_ARRAY: {
+				std::vector<float> a(e.asArrayLength()+1);
+				e.asFloatArray(a.data());
+				break;
+			}
+			case eValue::BOTTLE:
+				walk(e.asList());
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+// every string used as a key finds what a plain scan finds
+static void lookup(const eBottle & b) {
+	for (unsigned int i=0; i<b.size(); i++) {
+		if (b.get(i).getType()!=eValue::STRING) {
+			continue;
+		}
+		const ConstString key=b.get(i).asString();
+		const eValue * expected=NULL;
+		for (unsigned int j=0; j<b.size(); j++) {
+			const eValue & e=b.get(j);
+			if (e.getType()==eValue::STRING && j+1<b.size() && e.asString()==key) {
+				expected=b.getPtr(j+1);
+				break;
+			}
+			if (e.getType()==eValue::BOTTLE && e.asList()->size()>0 && e.asList()->get(0).getType()==eValue::STRING && e.asList()->get(0).asString()==key) {
+				expected=(e.asList()->size()>1) ? e.asList()->getPtr(1) : NULL;
+				break;
+			}
+		}
+		if (strlen(key.c_str())==key.length() && b.find(key.c_str())!=expected) {
+			abort();
+		}
+	}
+}
+
+// recycled blocks would hide the use of freed eValues and eBottles
+extern "C" int LLVMFuzzerInitialize(int *, char ***) {
+	ePool::setLimit(0);
+	return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+	if (size>(1<<20)) {
+		return 0;
+	}
+	eBottle b;
+	bool valid=b.fromBinary((const char *) data, size);
+	if (valid) {
+		int n;
+		const char * p=b.toBinary(&n);
+		if ((unsigned int) n!=b.getBinarySize()) {
+			abort();
+		}
+		eBottle c;
+		if (!c.fromBinary(p, n) || c.toString()!=b.toString()) {
+			abort();
+		}
+		// and compressed
+		b.setCompression(16);
+		p=b.toBinary(&n);
+		eBottle z;
+		if ((unsigned int) n>b.getBinarySize() || !z.fromBinary(p, n) || z.toString()!=b.toString()) {
+			abort();
+		}
+		lookup(b);
+	}
+
+	// the incremental decoder, reusing the eValues of a previous message
+	eBottle d("1 (2 x) 3.5");
+	eBottleDecoder decoder(d);
+	decoder.begin(size);
+	for (size_t at=0, k=1; decoder.status()==eBottleDecoder::MORE; at+=k, k=k%13+1) {
+		decoder.feed((const char *) data+at, (k<size-at) ? k : size-at);
+	}
+	if ((decoder.status()==eBottleDecoder::DONE)!=valid || (valid && d.toString()!=b.toString())) {
+		abort();
+	}
+
+	// read() reusing the eValues of a previous message
+	RawMessage m(data, size);
+	eBottle r("1 2.5 text (3 4) {5 6} [i 7 8] [d 9]");
+	if (Portable::copyPortable(m, r)) {
+		int n;
+		r.toBinary(&n);
+		if ((unsigned int) n!=r.getBinarySize()) {
+			abort();
+		}
+	}
+
+	// a delta stream reader, synchronized by a keyframe first
+	eBottle source("1 2.5 text (3 4) {5 6} [i 7 8] [d 9]");
+	eBottle t;
+	eBottleDeltaWriter writer(source);
+	eBottleDeltaReader reader(t);
+	if (!Portable::copyPortable(writer, reader)) {
+		abort();
+	}
+	if (Portable::copyPortable(m, reader)) {
+		int n;
+		t.toBinary(&n);
+		if ((unsigned int) n!=t.getBinarySize()) {
+			abort();
+		}
+	}
+
+	eBottle v;
+	v.setViewMode(true);
+	if (Portable::copyPortable(m, v)) {
+		walk(v.view());
+	}
+	return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+int main(int argc, char ** argv) {
+	LLVMFuzzerInitialize(&argc, &argv);
+	for (int i=1; i<argc; i++) {
+		FILE * f=fopen(argv[i], "rb");
+		if (f==NULL) {
+			perror(argv[i]);
+			continue;
+		}
+		std::vector<uint8_t> d;
+		int c;
+		while ((c=fgetc(f))!=EOF) {
+			d.push_back(c);
+		}
+		fclose(f);
+		LLVMFuzzerTestOneInput(d.data(), d.size());
+	}
+	return 0;
+}
+#endif
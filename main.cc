@@ -26,7 +26,8 @@
  *
  *-------------------------------------------------------------------------*/
 
-#include "eBottle.h"
+#include <yarp/os/eBottle.h>
+#include <yarp/os/eShm.h>
 #include <yarp/os/all.h>
 #include <string>
 
@@ -41,17 +42,71 @@ int main(){
 	const char * p=eb1.toBinary(&size);	
 		
 	eBottle eb2;
-	eb2.fromBinary(p,size);
+	if (!eb2.fromBinary(p,size)) {
+		fprintf(stderr,"fromBinary: invalid representation\n");
+		return 1;
+	}
 	fprintf(stderr,"TOSTRING: eb2: %s\n",eb2.toString().c_str());
 	
 	int eb1_size=eb1.getBinarySize();
 	char * buff=new char[eb1_size];
-	eb1.toBinary(buff);
+	// -1 if eb1 grew past the buffer since getBinarySize()
+	int written=eb1.toBinary(buff);
+	if (written<0) {
+		fprintf(stderr,"toBinary: the buffer is too small\n");
+		return 1;
+	}
 	
 	eBottle eb3;
-	eb3.fromBinary(buff,eb1_size);
+	if (!eb3.fromBinary(buff,written)) {
+		fprintf(stderr,"fromBinary: invalid representation\n");
+		return 1;
+	}
 	fprintf(stderr,"TOSTRING: eb3: %s\n",eb3.toString().c_str());
-		
+	delete [] buff;
+
+	// a slot moved from is empty, and removed before going to text
+	eBottle moved("1 2.5 text");
+	eValue taken=std::move(moved.get(1));
+	if (moved.get(1).getType()!=eValue::EMPTY || taken.asDouble()!=2.5) {
+		fprintf(stderr,"move: the value was not taken\n");
+		return 1;
+	}
+	moved.remove(1);
+	eBottle text(moved.toString());
+	if (text.size()!=moved.size() || text.toString()!=moved.toString()) {
+		fprintf(stderr,"toString: the text does not read back\n");
+		return 1;
+	}
+
+	// the key index follows the values changed through the accessors
+	eBottle keys;
+	for (int i=0; i<(int) eBottle::INDEX_THRESHOLD; i++) {
+		keys.addAll("key", i);
+	}
+	if (keys.find("key")==NULL || keys.find("changed")!=NULL) {
+		fprintf(stderr,"find: wrong value\n");
+		return 1;
+	}
+	keys.get(4)=eValue("changed");
+	if (keys.find("changed")!=&keys.get(5)) {
+		fprintf(stderr,"find: the index was not rebuilt\n");
+		return 1;
+	}
+
+	// lists read in parallel over the lists of another shape
+	eBottle::setThreads(4);
+	eBottle eb7, eb8, eb9;
+	for (int i=0; i<4000; i++) {
+		eb7.addList().addAll(1, 2, 3, 4);
+		eb8.addList().addAll("s", "t", "x", "y");
+	}
+	eb9.setParallel(1024);
+	if (!Portable::copyPortable(eb7, eb9) || !Portable::copyPortable(eb8, eb9) || eb9.toString()!=eb8.toString()) {
+		fprintf(stderr,"read: parallel decoding failed\n");
+		return 1;
+	}
+
 	Network::init();
 	BufferedPort<eBottle> bp1;
 	BufferedPort<eBottle> bp2;
@@ -65,4 +120,13 @@ int main(){
 	bp1.write();
 	eBottle * eb5= bp2.read();
 	fprintf(stderr,"TOSTRING: eb5: %s\n",eb5->toString().c_str());
+
+	eShmWriter sw;
+	eShmReader sr;
+	sw.open("/shm");
+	sr.open("/shm");
+	sw.write(eb1);
+	eBottle eb6;
+	sr.read(eb6);
+	fprintf(stderr,"TOSTRING: eb6: %s\n",eb6.toString().c_str());
 }